@@ -14,8 +14,30 @@
 *   This part is simple enough to implement as it just requires
 *    looping over each report and checking the levels against
 *    the "safe" criteria. To determine whether the levels are
-*    safe, I'm computing the "diff" on each `level` array, which
-*    calculates the difference between adjacent elements.
+*    safe, I'm looking at the difference between each pair of
+*    adjacent levels.
+*   The reports are kept in a single growable array of levels,
+*    with a second array holding the offset where each report
+*    starts. Levels are stored in the narrowest integer type
+*    that fits every value seen so far (one byte for typical
+*    inputs), and the store widens itself if a bigger value
+*    shows up. Reports can be any length.
+*   The input is memory-mapped and tokenized 64 bytes at a
+*    time. Each block is compared against the separator
+*    characters with SSE2 to get a bit mask of where the spaces
+*    and newlines are, and the set bits are walked to find each
+*    number, which is converted by hand. No libc string
+*    functions are involved.
+*   Passing `-S` streams the input instead (use `-` to read
+*    from stdin): each report is judged as soon as its line is
+*    complete, and only the current line is ever held in
+*    memory. With `-P N`, a progress line is written to stderr
+*    after every N reports.
+*   Passing `-j N` splits the mapped input into N byte ranges,
+*    each nudged forward to start just after a newline so no
+*    report is cut in two. Every thread tokenizes and judges its
+*    own range a piece at a time, keeping its own count of safe
+*    reports, and the counts are added up at the end.
 *
 *   Part Two:
 *   Using the same input file and criteria outlined above, we
@@ -24,123 +46,737 @@
 *    single bad level. In other words, if a report can meet
 *    the Part One criteria by having a single level removed,
 *    it is now considered safe.
-*   My implementation for this second part is not elegant. I
-*    was running low on time, so I decided to brute force my
-*    way to solution by taking the most obvious approach: for
-*    any unsafe report, rerun the safety check after
-*    sequentially removing one level from the array.
+*   Rather than rerunning the safety check once for every
+*    level that could be removed, I scan the report once per
+*    direction (ascending and descending) for the first pair of
+*    levels that breaks the rules. Any fix has to remove one of
+*    those two levels, so only those two candidates need to be
+*    checked, which keeps the whole thing linear.
+*   Passing `-k N` tolerates up to N bad levels instead of one.
+*    That case uses a small dynamic program: for each level,
+*    find the fewest levels that must be removed before it so
+*    that it ends a safe run, looking back at most N + 1 levels.
+*
+*   Part One checks are done 16 reports at a time. The reports
+*    are transposed into a batch where each report gets its own
+*    lane, so level j of all 16 reports sits in one row. One
+*    pass over the rows then checks the bounds and direction of
+*    every lane at once with AVX-512 or AVX2, picked at runtime
+*    based on what the CPU supports (`-s` forces the plain C
+*    version). Only the reports that fail go on to the dampener.
+*
+*   Passing `-B N` times the checks on random reports, about N
+*    MB of them if they were written out as text. The dampener
+*    is raced against the original loop, which removes each
+*    level in turn and reruns the Part One check, on reports of
+*    10, 100 and 1000 levels. Then each batch kernel is timed on
+*    its own, over reports shaped like the puzzle input that
+*    have already been loaded into batches. Last, the same kind
+*    of reports are written out as text in memory and parsed
+*    into a store, both by the tokenizer and by the original
+*    `fgets`, `strtok` and `atoi` loop. With `-j N`, the text is
+*    also written to a temporary file and counted in full with
+*    1, 2, 4 and so on up to N threads.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#define REPORT_STORE_INIT_LEVELS   (1 << 16)
+#define REPORT_STORE_INIT_REPORTS  (1 << 13)
+
+// Compressed storage for every report. The levels of report
+//  `i` are `levels[offsets[i]]` up to `levels[offsets[i + 1]]`,
+//  each `width` bytes wide (1, 2 or 4).
+struct report_store {
+  void *levels;
+  int width;
+  long long num_levels;
+  long long max_levels;
+
+  long long *offsets;
+  long long num_reports;
+  long long max_reports;
+
+  // Number of levels in the longest report
+  int longest;
+};
+
+int report_store_init(struct report_store *rs);
+void report_store_cleanup(struct report_store *rs);
+
+// Append `level` to the report currently being built. Return
+//  nonzero on allocation failure.
+int report_store_add_level(struct report_store *rs, int level);
+
+// Finish the report currently being built. Empty reports are
+//  discarded. Return nonzero on allocation failure.
+int report_store_end_report(struct report_store *rs);
+
+// Copy the levels of report `i` into `out`, which must have
+//  room for `rs->longest` levels, and return how many there
+//  are.
+int report_store_get(const struct report_store *rs, long long i, int *out);
+
+// Return level `j` of report `i`
+int report_store_level(const struct report_store *rs, long long i, int j);
+
+// Return the number of levels in report `i`
+int report_store_size(const struct report_store *rs, long long i);
+
+#define TOKENIZER_BLOCK  (64)
+
+// Return a bit mask with bit `i` set if `block[i]` separates
+//  two levels (a space, tab, carriage return or newline), and
+//  place the mask of just the newlines in `newlines`.
+uint64_t tokenizer_classify(const char *block, uint64_t *newlines);
+
+// Convert the level spelled out in [s, end) to an integer
+int tokenizer_parse_level(const char *s, const char *end);
+
+// Tokenize the `size` bytes of `data` into reports and append
+//  them to `rs`. Return nonzero on allocation failure.
+int tokenize_reports(const char *data, size_t size, struct report_store *rs);
+
+// Memory-map `filename`, placing the mapping in `data` and
+//  its length in `size`. Return nonzero on error.
+int map_input(const char *filename, const char **data, size_t *size);
+void unmap_input(const char *data, size_t size);
+
+// Memory-map `filename` and load its reports into `rs`.
+//  Return nonzero on error.
+int load_reports(const char *filename, struct report_store *rs);
+
+// Empty the store without giving back its memory
+void report_store_clear(struct report_store *rs);
+
+#define BATCH_LANES       (16)
+#define BATCH_MAX_LEVELS  (10)
+
+// Up to BATCH_LANES reports laid out side by side: `level[j]`
+//  holds level j of every report in the batch. Unused lanes
+//  have zero levels and always come out safe.
+struct report_batch {
+  int level[BATCH_MAX_LEVELS][BATCH_LANES] __attribute__((aligned(64)));
+  int num_levels[BATCH_LANES] __attribute__((aligned(64)));
+};
+
+// A batch kernel returns a bit mask with bit `i` set if the
+//  report in lane `i` meets the Part One criteria.
+typedef unsigned int (*batch_kernel)(const struct report_batch *batch);
+
+// Copy `count` reports starting at report `first` into the
+//  lanes of `batch`. Reports longer than BATCH_MAX_LEVELS are
+//  left out; return a mask of the lanes that were loaded.
+unsigned int report_batch_load(struct report_batch *batch, const struct report_store *rs,
+                               long long first, int count);
+
+unsigned int report_batch_safe_scalar(const struct report_batch *batch);
+#ifdef HAVE_X86_KERNELS
+unsigned int report_batch_safe_avx2(const struct report_batch *batch);
+unsigned int report_batch_safe_avx512(const struct report_batch *batch);
+#endif
+
+// Pick the widest batch kernel the CPU supports
+batch_kernel report_batch_select_kernel(void);
+
+// Return true if the `size` levels in `level` meet the
+//  criteria laid out in Part One.
+bool report_is_safe(const int *level, int size);
+
+// Return true if levels `a` and `b` may appear next to each
+//  other in a report that's ascending (`dir` = 1) or
+//  descending (`dir` = -1).
+bool levels_ok(int a, int b, int dir);
+
+// Return true if the `size` levels in `level` are safe in the
+//  direction `dir` once the level at index `skip` is removed.
+//  Pass a negative `skip` to keep every level.
+bool levels_safe_skip(const int *level, int size, int skip, int dir);
+
+// Return true if the report is safe after removing at most one
+//  level. Runs in linear time.
+bool report_is_safe_dampened(const int *level, int size);
 
-#define MAX_LEVELS  (10)
-#define NUM_REPORTS_INIT  (1000)
+// Return true if the report is safe after removing at most
+//  `tolerance` levels. `scratch` must have room for `size`
+//  integers.
+bool report_is_safe_tolerant(const int *level, int size, int tolerance, int *scratch);
 
-struct report {
-  int level[MAX_LEVELS];
-  int num_levels;
+// Return true if the report meets the Part One criteria, or
+//  can be made to by removing at most `tolerance` levels.
+//  `scratch` must have room for `size` integers.
+bool report_judge(const int *level, int size, int tolerance, int *scratch);
+
+// Count the reports in `rs` that are safe with up to
+//  `tolerance` bad levels and add them to `safe_count`. Return
+//  nonzero on allocation failure.
+int count_safe_reports(const struct report_store *rs, batch_kernel kernel, int tolerance,
+                       long long *safe_count);
+
+#define MAX_THREADS     (256)
+#define CHUNK_PIECE     (1 << 20)
+
+// A range of the mapped input handled by one thread
+struct chunk_job {
+  const char *data;
+  size_t begin;
+  size_t end;
+  batch_kernel kernel;
+  int tolerance;
+  long long safe_count;
+  int ret;
 };
 
-// Return true if the levels contained with the report
-//  meet the criteria laid out in Part One.
-bool report_is_safe(const struct report *report);
+// Tokenize and judge one chunk of the input, a piece of about
+//  CHUNK_PIECE bytes at a time
+void *chunk_worker(void *arg);
+
+// Count the safe reports in `filename` using `threads` threads
+int parallel_count(const char *filename, int threads, batch_kernel kernel, int tolerance,
+                   long long *safe_count);
+
+#define STREAM_BUF_INIT  (64 * 1024)
+
+// Stream reports from `filename` (or stdin if it's "-") and
+//  count the safe ones in `safe_count`, holding only one line
+//  in memory at a time. If `progress` is positive, report
+//  progress to stderr every `progress` reports. Return nonzero
+//  on error.
+int stream_reports(const char *filename, int tolerance, long long progress, long long *safe_count);
+
+#define BENCH_REPEATS  (3)
+
+// Return true if the report is safe after removing at most one
+//  level, by removing each level in turn and rerunning the Part
+//  One check like the original did. `scratch` must have room
+//  for `size` integers.
+bool report_is_safe_brute(const int *level, int size, int *scratch);
 
-// Given input array `in` containing `size` elements,
-//  calculate the diff array `out`. Each element of
-//  the diff array is the difference between adjacent
-//  elements of the input array. If the input array
-//  contains elements [A0,A1,A2,A3], the diff array
-//  contains elements [A1-A0,A2-A1,A3-A2]. The diff
-//  array will contain one less element than the input
-//  array.
-void diff(const int *in, int size, int * const out);
+// Read the reports in `f` into `rs` one line at a time with
+//  `fgets`, `strtok` and `atoi`, like the original did. Lines
+//  longer than the original's 100-byte buffer get split.
+//  Return nonzero on allocation failure.
+int tokenize_reports_strtok(FILE *f, struct report_store *rs);
 
-// Remove a level at index `idx` from report `in` and place
-//  the new level data in the report `out`.
-void remove_level(const struct report *in, struct report *out, int idx);
+// Time the checks on random reports, about `size_mb` megabytes
+//  of them as text, and the whole count with up to `threads`
+//  threads. Return nonzero on failure.
+int run_benchmark(int size_mb, int threads);
 
 int main(int argc, char *argv[])
 {
-  if (argc < 2) {
+  int tolerance = 1;
+  batch_kernel kernel = report_batch_select_kernel();
+  bool streaming = false;
+  long long progress = 0;
+  int threads = 1;
+  int bench_mb = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "k:sSP:j:B:")) != -1) {
+    switch (opt) {
+      case 'k':
+        tolerance = atoi(optarg);
+        break;
+
+      case 's':
+        kernel = report_batch_safe_scalar;
+        break;
+
+      case 'S':
+        streaming = true;
+        break;
+
+      case 'P':
+        progress = atoll(optarg);
+        break;
+
+      case 'j':
+        threads = atoi(optarg);
+        break;
+
+      case 'B':
+        bench_mb = atoi(optarg);
+        break;
+
+      default:
+        printf("Usage: %s [-k tolerance] [-s] [-j threads] [-S [-P progress]] file\n"
+               "       %s -B size_mb [-j threads]\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (threads < 1)            threads = 1;
+  if (threads > MAX_THREADS)  threads = MAX_THREADS;
+
+  if (bench_mb > 0) {
+    if (run_benchmark(bench_mb, threads)) {
+      printf("Zoinks\n");
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind >= argc) {
     printf("Missing file name in second argument position\n");
     return EXIT_FAILURE;
   }
 
-  char *filename = argv[1];
-  FILE *f = fopen(filename, "r");
+  char *filename = argv[optind];
 
-  if (f == NULL) {
+  if (streaming) {
+    long long safe_count = 0;
+
+    if (stream_reports(filename, tolerance, progress, &safe_count)) {
+      printf("Zoinks\n");
+      return EXIT_FAILURE;
+    }
+
+    printf("%lld reports are safe\n", safe_count);
+
+    return EXIT_SUCCESS;
+  }
+
+  long long safe_count = 0;
+  int ret;
+
+  if (threads > 1) {
+    ret = parallel_count(filename, threads, kernel, tolerance, &safe_count);
+  }
+  else {
+    struct report_store rs;
+    if (report_store_init(&rs)) {
+      printf("Zoinks\n");
+      return EXIT_FAILURE;
+    }
+
+    ret = load_reports(filename, &rs) ||
+          count_safe_reports(&rs, kernel, tolerance, &safe_count);
+
+    report_store_cleanup(&rs);
+  }
+
+  if (ret) {
     printf("Zoinks\n");
     return EXIT_FAILURE;
   }
 
-  struct report report[NUM_REPORTS_INIT];
-  memset(report, 0, sizeof(report));
+  printf("%lld reports are safe\n", safe_count);
 
-  char line[100];
-  char *token;
-  int num_reports = 0;
-  int level_idx = 0;
-
-  // Our input data consists of spaced-delimited numbers
-  //  organized into rows called reports. Sequentially
-  //  read each line of the file and split each line into
-  //  token using `strtok()`. Convert each token into an
-  //  integer and save the level into the report.
-  while (fgets(line, sizeof(line), f)) {
-    token = strtok(line, " ");
-    while (token) {
-      level_idx = report[num_reports].num_levels++;
-      report[num_reports].level[level_idx] = atoi(token);
-      token = strtok(NULL, " ");
-    }
+  return EXIT_SUCCESS;
+}
+
+int count_safe_reports(const struct report_store *rs, batch_kernel kernel, int tolerance,
+                       long long *safe_count)
+{
+  // Scratch space for one report's levels, plus one more for
+  //  the dynamic program behind `-k`.
+  int *levels = malloc(sizeof(int) * ((rs->longest > 0) ? rs->longest : 1));
+  int *scratch = malloc(sizeof(int) * ((rs->longest > 0) ? rs->longest : 1));
 
-    num_reports++;
+  if ((levels == NULL) || (scratch == NULL)) {
+    free(levels);
+    free(scratch);
+    return 1;
   }
 
-  int safe_count = 0;
-  bool enable_dampener = true;
-  struct report temp;
+  struct report_batch batch;
+  unsigned int loaded;
+  unsigned int safe_mask;
+  int count;
+  int size;
 
-  // Sequentially examine each report to determine if it's
-  //  safe or not. If the dampener is enabled (Part Two),
+  // Examine the reports a batch at a time to determine which
+  //  are safe. If the dampener is enabled (Part Two),
   //  re-examine each unsafe report by checking if the
-  //  report can be considered safe if a single level is
+  //  report can be considered safe once some bad levels are
   //  removed.
-  for (int i = 0; i < num_reports; i++) {
-    if (report_is_safe(&report[i])) {
-      safe_count++;
+  for (long long i = 0; i < rs->num_reports; i += BATCH_LANES) {
+    count = ((rs->num_reports - i) < BATCH_LANES) ? (int)(rs->num_reports - i) : BATCH_LANES;
+
+    loaded = report_batch_load(&batch, rs, i, count);
+    safe_mask = kernel(&batch) & loaded;
+
+    for (int l = 0; l < count; l++) {
+      if (safe_mask & (1u << l)) {
+        (*safe_count)++;
+        continue;
+      }
+
+      size = report_store_get(rs, i + l, levels);
+
+      // Reports too long for the batch still need a Part One
+      //  check, and the rest only repeat one that's already
+      //  failed, so every leftover report is judged the same
+      //  way as a streamed one.
+      if (report_judge(levels, size, tolerance, scratch)) {
+        (*safe_count)++;
+      }
     }
-    else if (enable_dampener) {
-      for (int l = 0; l < report[i].num_levels; l++) {
-        remove_level(&report[i], &temp, l);
+  }
 
-        if (report_is_safe(&temp)) {
-          safe_count++;
-          break;
-        }
+  free(levels);
+  free(scratch);
+
+  return 0;
+}
+
+int report_store_init(struct report_store *rs)
+{
+  rs->width = 1;
+  rs->num_levels = 0;
+  rs->max_levels = REPORT_STORE_INIT_LEVELS;
+  rs->levels = malloc(rs->max_levels * rs->width);
+
+  rs->num_reports = 0;
+  rs->max_reports = REPORT_STORE_INIT_REPORTS;
+  rs->offsets = malloc(sizeof(long long) * (rs->max_reports + 1));
+
+  rs->longest = 0;
+
+  if ((rs->levels == NULL) || (rs->offsets == NULL)) {
+    report_store_cleanup(rs);
+    return 1;
+  }
+
+  rs->offsets[0] = 0;
+
+  return 0;
+}
+
+void report_store_cleanup(struct report_store *rs)
+{
+  free(rs->levels);
+  free(rs->offsets);
+
+  rs->levels = NULL;
+  rs->offsets = NULL;
+  rs->num_levels = 0;
+  rs->max_levels = 0;
+  rs->num_reports = 0;
+  rs->max_reports = 0;
+}
+
+// Copy the levels into a wider integer type so `level` fits
+static int report_store_widen(struct report_store *rs, int level)
+{
+  int width = ((level >= INT16_MIN) && (level <= INT16_MAX)) ? 2 : 4;
+  if (width <= rs->width) {
+    width = 4;
+  }
+
+  void *levels = malloc(rs->max_levels * width);
+  if (levels == NULL) {
+    return 1;
+  }
+
+  for (long long i = 0; i < rs->num_levels; i++) {
+    int v;
+
+    if (rs->width == 1)       v = ((int8_t *)rs->levels)[i];
+    else if (rs->width == 2)  v = ((int16_t *)rs->levels)[i];
+    else                      v = ((int32_t *)rs->levels)[i];
+
+    if (width == 2)  ((int16_t *)levels)[i] = (int16_t)v;
+    else             ((int32_t *)levels)[i] = v;
+  }
+
+  free(rs->levels);
+  rs->levels = levels;
+  rs->width = width;
+
+  return 0;
+}
+
+void report_store_clear(struct report_store *rs)
+{
+  rs->num_levels = 0;
+  rs->num_reports = 0;
+  rs->longest = 0;
+}
+
+int report_store_add_level(struct report_store *rs, int level)
+{
+  bool fits =
+    (rs->width == 4) ||
+    ((rs->width == 2) && (level >= INT16_MIN) && (level <= INT16_MAX)) ||
+    ((rs->width == 1) && (level >= INT8_MIN) && (level <= INT8_MAX));
+
+  if (!fits && report_store_widen(rs, level)) {
+    return 1;
+  }
+
+  if (rs->num_levels == rs->max_levels) {
+    void *levels = realloc(rs->levels, rs->max_levels * 2 * rs->width);
+    if (levels == NULL) {
+      return 1;
+    }
+
+    rs->levels = levels;
+    rs->max_levels *= 2;
+  }
+
+  if (rs->width == 1)       ((int8_t *)rs->levels)[rs->num_levels] = (int8_t)level;
+  else if (rs->width == 2)  ((int16_t *)rs->levels)[rs->num_levels] = (int16_t)level;
+  else                      ((int32_t *)rs->levels)[rs->num_levels] = level;
+
+  rs->num_levels++;
+
+  return 0;
+}
+
+int report_store_end_report(struct report_store *rs)
+{
+  long long size = rs->num_levels - rs->offsets[rs->num_reports];
+  if (size == 0) {
+    return 0;
+  }
+
+  if (size > INT32_MAX) {
+    return 1;
+  }
+
+  if (rs->num_reports == rs->max_reports) {
+    long long *offsets = realloc(rs->offsets, sizeof(long long) * ((rs->max_reports * 2) + 1));
+    if (offsets == NULL) {
+      return 1;
+    }
+
+    rs->offsets = offsets;
+    rs->max_reports *= 2;
+  }
+
+  if (size > rs->longest) {
+    rs->longest = (int)size;
+  }
+
+  rs->offsets[++rs->num_reports] = rs->num_levels;
+
+  return 0;
+}
+
+int report_store_level(const struct report_store *rs, long long i, int j)
+{
+  long long idx = rs->offsets[i] + j;
+
+  if (rs->width == 1)  return ((const int8_t *)rs->levels)[idx];
+  if (rs->width == 2)  return ((const int16_t *)rs->levels)[idx];
+  return ((const int32_t *)rs->levels)[idx];
+}
+
+int report_store_size(const struct report_store *rs, long long i)
+{
+  return (int)(rs->offsets[i + 1] - rs->offsets[i]);
+}
+
+int report_store_get(const struct report_store *rs, long long i, int *out)
+{
+  int size = report_store_size(rs, i);
+
+  for (int j = 0; j < size; j++) {
+    out[j] = report_store_level(rs, i, j);
+  }
+
+  return size;
+}
+
+uint64_t tokenizer_classify(const char *block, uint64_t *newlines)
+{
+  uint64_t separators = 0;
+  uint64_t nl = 0;
+
+#ifdef HAVE_X86_KERNELS
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+
+  for (int i = 0; i < TOKENIZER_BLOCK; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&block[i]);
+    __m128i is_lf = _mm_cmpeq_epi8(v, lf);
+    __m128i is_sep = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, cr), is_lf));
+
+    nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_lf) << i;
+    separators |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_sep) << i;
+  }
+#else
+  for (int i = 0; i < TOKENIZER_BLOCK; i++) {
+    char c = block[i];
+
+    if (c == '\n') {
+      nl |= 1ULL << i;
+    }
+
+    if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
+      separators |= 1ULL << i;
+    }
+  }
+#endif
+
+  *newlines = nl;
+
+  return separators;
+}
+
+int tokenizer_parse_level(const char *s, const char *end)
+{
+  bool negative = false;
+  int n = 0;
+
+  if ((s < end) && ((*s == '-') || (*s == '+'))) {
+    negative = (*s == '-');
+    s++;
+  }
+
+  // Like `atoi()`, stop at the first character that isn't a
+  //  digit.
+  while ((s < end) && ((unsigned)(*s - '0') <= 9)) {
+    n = (n * 10) + (*s - '0');
+    s++;
+  }
+
+  return negative ? -n : n;
+}
+
+int tokenize_reports(const char *data, size_t size, struct report_store *rs)
+{
+  char tail[TOKENIZER_BLOCK];
+  const char *block;
+  uint64_t separators;
+  uint64_t newlines;
+  size_t token_start = 0;
+  size_t pos;
+  int bit;
+
+  for (size_t base = 0; base < size; base += TOKENIZER_BLOCK) {
+    // Pad the final partial block with spaces so it can be
+    //  classified like any other.
+    if ((size - base) < TOKENIZER_BLOCK) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, &data[base], size - base);
+      block = tail;
+    }
+    else {
+      block = &data[base];
+    }
+
+    separators = tokenizer_classify(block, &newlines);
+
+    // Every separator ends whatever token started after the
+    //  previous one, and newlines also end the report.
+    while (separators) {
+      bit = __builtin_ctzll(separators);
+      pos = base + bit;
+
+      if (pos >= size) {
+        break;
+      }
+
+      if ((pos > token_start) &&
+          report_store_add_level(rs, tokenizer_parse_level(&data[token_start], &data[pos])))
+      {
+        return 1;
+      }
+
+      if ((newlines & (1ULL << bit)) && report_store_end_report(rs)) {
+        return 1;
       }
+
+      token_start = pos + 1;
+      separators &= separators - 1;
     }
   }
 
-  printf("%d reports are safe\n", safe_count);
+  // The last line might not end with a newline
+  if ((size > token_start) &&
+      report_store_add_level(rs, tokenizer_parse_level(&data[token_start], &data[size])))
+  {
+    return 1;
+  }
 
-  return EXIT_SUCCESS;
+  return report_store_end_report(rs);
+}
+
+int map_input(const char *filename, const char **data, size_t *size)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return 1;
+  }
+
+  *size = (size_t)st.st_size;
+  *data = NULL;
+
+  if (*size > 0) {
+    *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*data == MAP_FAILED) {
+      *data = NULL;
+      close(fd);
+      return 1;
+    }
+
+    madvise((void *)*data, *size, MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+
+  return 0;
 }
 
-bool report_is_safe(const struct report *report)
+void unmap_input(const char *data, size_t size)
 {
-  int d[MAX_LEVELS];
-  diff(report->level, report->num_levels, d);
+  if (data != NULL) {
+    munmap((void *)data, size);
+  }
+}
+
+int load_reports(const char *filename, struct report_store *rs)
+{
+  const char *data;
+  size_t size;
+
+  if (map_input(filename, &data, &size)) {
+    return 1;
+  }
+
+  int ret = tokenize_reports(data, size, rs);
+
+  unmap_input(data, size);
 
+  return ret;
+}
+
+bool report_is_safe(const int *level, int size)
+{
   int elem = 0;
   int positive_count = 0;
   int negative_count = 0;
-  for (int i = 0; i < (report->num_levels - 1); i++) {
-    elem = d[i];
+  for (int i = 0; i < (size - 1); i++) {
+    elem = level[i + 1] - level[i];
 
     // A report is safe if all adjacent levels differ by at
     //  least one and at most three.
@@ -156,28 +792,1042 @@ bool report_is_safe(const struct report *report)
     }
   }
 
-  // If the diff values contain a mix of positive and negative
+  // If the differences contain a mix of positive and negative
   //  numbers, the corresponding levels are neither in ascending
   //  or descending order and thus are unsafe.
   return !((positive_count > 0) && (negative_count > 0));
 }
 
-void diff(const int *in, int size, int * const out)
+bool levels_ok(int a, int b, int dir)
 {
-  for (int i = 0; i < (size - 1); i++) {
-    out[i] = in[i + 1] - in[i];
+  int d = (b - a) * dir;
+
+  return (d >= 1) && (d <= 3);
+}
+
+bool levels_safe_skip(const int *level, int size, int skip, int dir)
+{
+  int prev = -1;
+
+  for (int i = 0; i < size; i++) {
+    if (i == skip) {
+      continue;
+    }
+
+    if ((prev >= 0) && !levels_ok(level[prev], level[i], dir)) {
+      return false;
+    }
+
+    prev = i;
+  }
+
+  return true;
+}
+
+bool report_is_safe_dampened(const int *level, int size)
+{
+  int bad;
+
+  for (int dir = -1; dir <= 1; dir += 2) {
+    // Find the first adjacent pair that breaks the rules
+    bad = -1;
+    for (int i = 0; i < (size - 1); i++) {
+      if (!levels_ok(level[i], level[i + 1], dir)) {
+        bad = i;
+        break;
+      }
+    }
+
+    if (bad < 0) {
+      return true;
+    }
+
+    // One of the two levels in the bad pair has to go
+    if (levels_safe_skip(level, size, bad, dir) ||
+        levels_safe_skip(level, size, bad + 1, dir))
+    {
+      return true;
+    }
   }
+
+  return false;
 }
 
-void remove_level(const struct report *in, struct report *out, int idx)
+bool report_is_safe_tolerant(const int *level, int size, int tolerance, int *scratch)
 {
-  int idx_new = 0;
+  if (size <= (tolerance + 1)) {
+    return true;
+  }
+
+  // removed[j] is the fewest levels that must be removed before
+  //  index j so that level j ends a safe run. A run can only skip
+  //  `tolerance` levels in a row, so look back that far and no
+  //  further.
+  int *removed = scratch;
+  int best;
+  int cost;
+
+  for (int dir = -1; dir <= 1; dir += 2) {
+    for (int j = 0; j < size; j++) {
+      best = j;
+
+      for (int p = j - 1; (p >= 0) && (p >= (j - tolerance - 1)); p--) {
+        if (levels_ok(level[p], level[j], dir)) {
+          cost = removed[p] + (j - p - 1);
+          if (cost < best) best = cost;
+        }
+      }
 
-  for (int i = 0; i < in->num_levels; i++) {
-    if (i != idx) {
-      out->level[idx_new++] = in->level[i];
+      removed[j] = best;
+
+      // Everything after level j gets removed as well
+      if ((best + (size - 1 - j)) <= tolerance) {
+        return true;
+      }
     }
   }
 
-  out->num_levels = in->num_levels - 1;
+  return false;
+}
+
+unsigned int report_batch_load(struct report_batch *batch, const struct report_store *rs,
+                               long long first, int count)
+{
+  unsigned int loaded = 0;
+  int size;
+
+  memset(batch, 0, sizeof(*batch));
+
+  for (int l = 0; l < count; l++) {
+    size = report_store_size(rs, first + l);
+    if (size > BATCH_MAX_LEVELS) {
+      continue;
+    }
+
+    batch->num_levels[l] = size;
+    loaded |= (1u << l);
+
+    for (int j = 0; j < size; j++) {
+      batch->level[j][l] = report_store_level(rs, first + l, j);
+    }
+  }
+
+  return loaded;
+}
+
+unsigned int report_batch_safe_scalar(const struct report_batch *batch)
+{
+  bool ascending[BATCH_LANES];
+  bool descending[BATCH_LANES];
+  unsigned int mask = 0;
+  int d;
+
+  for (int l = 0; l < BATCH_LANES; l++) {
+    ascending[l] = true;
+    descending[l] = true;
+  }
+
+  for (int j = 0; j < (BATCH_MAX_LEVELS - 1); j++) {
+    for (int l = 0; l < BATCH_LANES; l++) {
+      if ((j + 1) < batch->num_levels[l]) {
+        d = batch->level[j + 1][l] - batch->level[j][l];
+        ascending[l] = ascending[l] && (d >= 1) && (d <= 3);
+        descending[l] = descending[l] && (d >= -3) && (d <= -1);
+      }
+    }
+  }
+
+  for (int l = 0; l < BATCH_LANES; l++) {
+    if (ascending[l] || descending[l]) {
+      mask |= (1u << l);
+    }
+  }
+
+  return mask;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+unsigned int report_batch_safe_avx2(const struct report_batch *batch)
+{
+  const __m256i four = _mm256_set1_epi32(4);
+  unsigned int mask = 0;
+
+  // Two passes of eight lanes each. A difference d is in
+  //  [1, 3] when both d > 0 and 4 > d; negate it to check the
+  //  descending case.
+  for (int half = 0; half < BATCH_LANES; half += 8) {
+    __m256i n = _mm256_load_si256((const __m256i *)&batch->num_levels[half]);
+    __m256i ascending = _mm256_set1_epi32(-1);
+    __m256i descending = _mm256_set1_epi32(-1);
+    __m256i prev = _mm256_load_si256((const __m256i *)&batch->level[0][half]);
+
+    for (int j = 1; j < BATCH_MAX_LEVELS; j++) {
+      __m256i curr = _mm256_load_si256((const __m256i *)&batch->level[j][half]);
+      __m256i d = _mm256_sub_epi32(curr, prev);
+      __m256i neg = _mm256_sub_epi32(_mm256_setzero_si256(), d);
+      __m256i unused = _mm256_cmpgt_epi32(_mm256_set1_epi32(j + 1), n);
+
+      __m256i asc_ok = _mm256_and_si256(_mm256_cmpgt_epi32(d, _mm256_setzero_si256()),
+                                        _mm256_cmpgt_epi32(four, d));
+      __m256i desc_ok = _mm256_and_si256(_mm256_cmpgt_epi32(neg, _mm256_setzero_si256()),
+                                         _mm256_cmpgt_epi32(four, neg));
+
+      ascending = _mm256_and_si256(ascending, _mm256_or_si256(asc_ok, unused));
+      descending = _mm256_and_si256(descending, _mm256_or_si256(desc_ok, unused));
+      prev = curr;
+    }
+
+    mask |= (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(ascending, descending))) << half;
+  }
+
+  return mask;
+}
+
+__attribute__((target("avx512f")))
+unsigned int report_batch_safe_avx512(const struct report_batch *batch)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i four = _mm512_set1_epi32(4);
+  __m512i n = _mm512_load_si512((const void *)batch->num_levels);
+  __m512i prev = _mm512_load_si512((const void *)batch->level[0]);
+  __mmask16 ascending = 0xFFFF;
+  __mmask16 descending = 0xFFFF;
+
+  for (int j = 1; j < BATCH_MAX_LEVELS; j++) {
+    __m512i curr = _mm512_load_si512((const void *)batch->level[j]);
+    __m512i d = _mm512_sub_epi32(curr, prev);
+    __m512i neg = _mm512_sub_epi32(zero, d);
+    __mmask16 unused = _mm512_cmple_epi32_mask(n, _mm512_set1_epi32(j));
+
+    __mmask16 asc_ok = _mm512_cmpgt_epi32_mask(d, zero) & _mm512_cmplt_epi32_mask(d, four);
+    __mmask16 desc_ok = _mm512_cmpgt_epi32_mask(neg, zero) & _mm512_cmplt_epi32_mask(neg, four);
+
+    ascending &= (asc_ok | unused);
+    descending &= (desc_ok | unused);
+    prev = curr;
+  }
+
+  return (unsigned int)(ascending | descending);
+}
+#endif
+
+batch_kernel report_batch_select_kernel(void)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f")) {
+    return report_batch_safe_avx512;
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    return report_batch_safe_avx2;
+  }
+#endif
+
+  return report_batch_safe_scalar;
+}
+
+bool report_judge(const int *level, int size, int tolerance, int *scratch)
+{
+  if (report_is_safe(level, size)) {
+    return true;
+  }
+
+  if (tolerance == 1) {
+    return report_is_safe_dampened(level, size);
+  }
+
+  if (tolerance > 1) {
+    return report_is_safe_tolerant(level, size, tolerance, scratch);
+  }
+
+  return false;
+}
+
+int stream_reports(const char *filename, int tolerance, long long progress, long long *safe_count)
+{
+  int fd = (strcmp(filename, "-") == 0) ? STDIN_FILENO : open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 1;
+  }
+
+  // `buf` holds the unfinished tail of the input; `levels` and
+  //  `scratch` hold the report on the current line. All three
+  //  only grow to fit the longest line.
+  size_t buf_max = STREAM_BUF_INIT;
+  size_t len = 0;
+  char *buf = malloc(buf_max);
+  int levels_max = STREAM_BUF_INIT / 2;
+  int *levels = malloc(sizeof(int) * levels_max);
+  int *scratch = malloc(sizeof(int) * levels_max);
+
+  long long num_reports = 0;
+  ssize_t n = 1;
+  int ret = ((buf == NULL) || (levels == NULL) || (scratch == NULL));
+
+  *safe_count = 0;
+
+  while ((ret == 0) && ((n > 0) || (len > 0))) {
+    if (len == buf_max) {
+      char *bigger = realloc(buf, buf_max * 2);
+      if (bigger == NULL) {
+        ret = 1;
+        break;
+      }
+
+      buf = bigger;
+      buf_max *= 2;
+    }
+
+    if (n > 0) {
+      // An interrupted read just needs to be tried again
+      do {
+        n = read(fd, &buf[len], buf_max - len);
+      } while ((n < 0) && (errno == EINTR));
+
+      if (n < 0) {
+        ret = 1;
+        break;
+      }
+
+      len += (size_t)n;
+    }
+
+    // Judge every complete line in the buffer. Once the input
+    //  runs dry, whatever is left is the last line.
+    char *start = buf;
+    char *end = buf + len;
+    char *nl;
+
+    while (start < end) {
+      nl = memchr(start, '\n', end - start);
+      if (nl == NULL) {
+        if (n > 0) {
+          break;
+        }
+
+        nl = end;
+      }
+
+      // A line of L bytes holds at most (L + 1) / 2 levels
+      int needed = (int)(((nl - start) + 1) / 2) + 1;
+      if (needed > levels_max) {
+        int *bigger_levels = realloc(levels, sizeof(int) * needed);
+        int *bigger_scratch = realloc(scratch, sizeof(int) * needed);
+
+        if (bigger_levels != NULL) levels = bigger_levels;
+        if (bigger_scratch != NULL) scratch = bigger_scratch;
+
+        if ((bigger_levels == NULL) || (bigger_scratch == NULL)) {
+          ret = 1;
+          break;
+        }
+
+        levels_max = needed;
+      }
+
+      int size = 0;
+      const char *p = start;
+      const char *token;
+
+      while (p < nl) {
+        while ((p < nl) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) {
+          p++;
+        }
+
+        token = p;
+        while ((p < nl) && (*p != ' ') && (*p != '\t') && (*p != '\r')) {
+          p++;
+        }
+
+        if (p > token) {
+          levels[size++] = tokenizer_parse_level(token, p);
+        }
+      }
+
+      if (size > 0) {
+        if (report_judge(levels, size, tolerance, scratch)) {
+          (*safe_count)++;
+        }
+
+        num_reports++;
+
+        if ((progress > 0) && ((num_reports % progress) == 0)) {
+          fprintf(stderr, "%lld reports processed, %lld safe\n", num_reports, *safe_count);
+        }
+      }
+
+      start = (nl < end) ? nl + 1 : end;
+    }
+
+    // Keep the unfinished line for the next read
+    len = end - start;
+    memmove(buf, start, len);
+
+    if ((n == 0) && (len == 0)) {
+      break;
+    }
+  }
+
+  free(buf);
+  free(levels);
+  free(scratch);
+
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+
+  return ret;
+}
+
+// Return the offset just past the first newline at or after
+//  `pos`, or `size` if there isn't one.
+static size_t next_line(const char *data, size_t size, size_t pos)
+{
+  if (pos >= size) {
+    return size;
+  }
+
+  const char *nl = memchr(&data[pos], '\n', size - pos);
+
+  return (nl == NULL) ? size : (size_t)(nl - data) + 1;
+}
+
+void *chunk_worker(void *arg)
+{
+  struct chunk_job *job = (struct chunk_job *)arg;
+  struct report_store rs;
+  size_t begin = job->begin;
+  size_t end;
+
+  job->safe_count = 0;
+  job->ret = report_store_init(&rs);
+
+  // Working through the chunk a piece at a time keeps each
+  //  thread's store small and warm in cache.
+  while ((job->ret == 0) && (begin < job->end)) {
+    end = next_line(job->data, job->end, begin + CHUNK_PIECE);
+
+    report_store_clear(&rs);
+    job->ret = tokenize_reports(&job->data[begin], end - begin, &rs) ||
+               count_safe_reports(&rs, job->kernel, job->tolerance, &job->safe_count);
+
+    begin = end;
+  }
+
+  report_store_cleanup(&rs);
+
+  return NULL;
+}
+
+int parallel_count(const char *filename, int threads, batch_kernel kernel, int tolerance,
+                   long long *safe_count)
+{
+  const char *data;
+  size_t size;
+
+  if (map_input(filename, &data, &size)) {
+    return 1;
+  }
+
+  pthread_t tid[MAX_THREADS];
+  struct chunk_job jobs[MAX_THREADS];
+  size_t begin = 0;
+  size_t end;
+  int started = 0;
+  int ret = 0;
+
+  // Split the input into even byte ranges, moving each split
+  //  point forward to the start of the next line.
+  for (int t = 0; t < threads; t++) {
+    end = (t == (threads - 1)) ?
+          size :
+          next_line(data, size, (size / threads) * (t + 1));
+    if (end < begin) {
+      end = begin;
+    }
+
+    jobs[t].data = data;
+    jobs[t].begin = begin;
+    jobs[t].end = end;
+    jobs[t].kernel = kernel;
+    jobs[t].tolerance = tolerance;
+    jobs[t].safe_count = 0;
+    jobs[t].ret = 0;
+
+    if (pthread_create(&tid[t], NULL, chunk_worker, &jobs[t])) {
+      ret = 1;
+      break;
+    }
+
+    started++;
+    begin = end;
+  }
+
+  *safe_count = 0;
+
+  for (int t = 0; t < started; t++) {
+    pthread_join(tid[t], NULL);
+
+    ret = ret || jobs[t].ret;
+    *safe_count += jobs[t].safe_count;
+  }
+
+  unmap_input(data, size);
+
+  return ret;
+}
+
+bool report_is_safe_brute(const int *level, int size, int *scratch)
+{
+  int n;
+
+  for (int skip = 0; skip < size; skip++) {
+    n = 0;
+    for (int i = 0; i < size; i++) {
+      if (i != skip) {
+        scratch[n++] = level[i];
+      }
+    }
+
+    if (report_is_safe(scratch, n)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int tokenize_reports_strtok(FILE *f, struct report_store *rs)
+{
+  char line[100];
+  char *token;
+
+  while (fgets(line, sizeof(line), f)) {
+    token = strtok(line, " ");
+    while (token) {
+      if (report_store_add_level(rs, atoi(token))) {
+        return 1;
+      }
+
+      token = strtok(NULL, " ");
+    }
+
+    if (report_store_end_report(rs)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Small xorshift generator so the benchmark reports are the
+//  same on every run and platform.
+static uint32_t bench_rand(uint32_t *seed)
+{
+  uint32_t x = *seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return *seed = x;
+}
+
+// Return the time in seconds from a monotonic clock
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+}
+
+// Fill `levels` with `count` reports of `length` levels each.
+//  Every report starts out safe, then most have one or two
+//  levels knocked out of place so the dampener has work to do.
+static void bench_fill_reports(int *levels, int count, int length, uint32_t *seed)
+{
+  int *level;
+  int dir;
+  int bad;
+
+  for (int i = 0; i < count; i++) {
+    level = &levels[(size_t)i * length];
+    dir = (bench_rand(seed) & 1) ? 1 : -1;
+
+    level[0] = 5000 + (int)(bench_rand(seed) % 100);
+    for (int j = 1; j < length; j++) {
+      level[j] = level[j - 1] + (dir * (1 + (int)(bench_rand(seed) % 3)));
+    }
+
+    // A quarter stay safe, half get one bad level and the
+    //  rest get two
+    bad = (int)(bench_rand(seed) % 4);
+    bad = (bad == 0) ? 0 : ((bad == 3) ? 2 : 1);
+
+    for (int b = 0; b < bad; b++) {
+      level[bench_rand(seed) % length] += 10;
+    }
+  }
+}
+
+// Append reports shaped like the puzzle input to `rs` until it
+//  holds at least `total` levels. Each has 5 to 8 levels below
+//  100, and about half have a level knocked out of place.
+//  Return nonzero on allocation failure.
+static int bench_fill_store(struct report_store *rs, long long total, uint32_t *seed)
+{
+  int level[8];
+  int size;
+  int dir;
+
+  while (rs->num_levels < total) {
+    size = 5 + (int)(bench_rand(seed) % 4);
+    dir = (bench_rand(seed) & 1) ? 1 : -1;
+
+    level[0] = 30 + (int)(bench_rand(seed) % 40);
+    for (int j = 1; j < size; j++) {
+      level[j] = level[j - 1] + (dir * (1 + (int)(bench_rand(seed) % 3)));
+    }
+
+    if (bench_rand(seed) & 1) {
+      level[bench_rand(seed) % size] += 4;
+    }
+
+    for (int j = 0; j < size; j++) {
+      if (report_store_add_level(rs, level[j])) {
+        return 1;
+      }
+    }
+
+    if (report_store_end_report(rs)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Time every batch kernel the CPU supports on reports holding
+//  about `total` levels. Return nonzero on failure.
+static int bench_batch_kernels(long long total, uint32_t *seed)
+{
+  static const char *kernel_names[] = {"scalar", "avx2", "avx512"};
+  batch_kernel kernels[] = {report_batch_safe_scalar, NULL, NULL};
+
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[1] = report_batch_safe_avx2;
+  }
+
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels[2] = report_batch_safe_avx512;
+  }
+#endif
+
+  struct report_store rs;
+  if (report_store_init(&rs)) {
+    return 1;
+  }
+
+  if (bench_fill_store(&rs, total, seed)) {
+    report_store_cleanup(&rs);
+    return 1;
+  }
+
+  // Load every batch up front so only the kernels are timed
+  long long num_batches = (rs.num_reports + BATCH_LANES - 1) / BATCH_LANES;
+  struct report_batch *batches = aligned_alloc(64, sizeof(struct report_batch) * num_batches);
+  unsigned int *loaded = malloc(sizeof(unsigned int) * num_batches);
+
+  if ((batches == NULL) || (loaded == NULL)) {
+    free(batches);
+    free(loaded);
+    report_store_cleanup(&rs);
+    return 1;
+  }
+
+  int count;
+  for (long long b = 0; b < num_batches; b++) {
+    count = ((rs.num_reports - (b * BATCH_LANES)) < BATCH_LANES) ?
+            (int)(rs.num_reports - (b * BATCH_LANES)) : BATCH_LANES;
+    loaded[b] = report_batch_load(&batches[b], &rs, b * BATCH_LANES, count);
+  }
+
+  double baseline = 0.0;
+  double best;
+  double start;
+  double elapsed;
+  double rate;
+  long long safe;
+  long long scalar_safe = 0;
+  int ret = 0;
+
+  printf("\n%-8s %18s %10s %10s\n", "kernel", "Mreports/s", "speedup", "safe");
+
+  // Speedups are relative to the scalar kernel
+  for (int k = 0; k < 3; k++) {
+    if (kernels[k] == NULL) {
+      continue;
+    }
+
+    best = 0.0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+      safe = 0;
+
+      start = bench_now();
+      for (long long b = 0; b < num_batches; b++) {
+        safe += __builtin_popcount(kernels[k](&batches[b]) & loaded[b]);
+      }
+      elapsed = bench_now() - start;
+
+      if ((r == 0) || (elapsed < best)) {
+        best = elapsed;
+      }
+    }
+
+    // Every kernel has to agree with the scalar one
+    if (k == 0) {
+      scalar_safe = safe;
+    }
+    else if (safe != scalar_safe) {
+      ret = 1;
+      break;
+    }
+
+    rate = (double)rs.num_reports / 1e6 / ((best > 0.0) ? best : 1e-9);
+    if (k == 0) {
+      baseline = rate;
+    }
+
+    printf("%-8s %18.1f %9.2fx %10lld\n", kernel_names[k], rate, rate / baseline, safe);
+  }
+
+  free(batches);
+  free(loaded);
+  report_store_cleanup(&rs);
+
+  return ret;
+}
+
+// Write the reports in `rs`, whose levels must all be below
+//  100, out as text. Return the text, placing its length in
+//  `size`, or NULL on allocation failure.
+static char *bench_write_text(const struct report_store *rs, size_t *size)
+{
+  // Each level takes at most three bytes with its separator
+  char *text = malloc((size_t)rs->num_levels * 3);
+  if (text == NULL) {
+    return NULL;
+  }
+
+  size_t len = 0;
+  int size_levels;
+  int level;
+
+  for (long long i = 0; i < rs->num_reports; i++) {
+    size_levels = report_store_size(rs, i);
+
+    for (int j = 0; j < size_levels; j++) {
+      level = report_store_level(rs, i, j);
+
+      if (level >= 10) {
+        text[len++] = (char)('0' + (level / 10));
+      }
+
+      text[len++] = (char)('0' + (level % 10));
+      text[len++] = (j == (size_levels - 1)) ? '\n' : ' ';
+    }
+  }
+
+  *size = len;
+
+  return text;
+}
+
+// Write reports holding about `total` levels out as text and
+//  time how long each loader takes to parse them back into a
+//  store. Return nonzero on failure.
+static int bench_tokenizer(long long total, uint32_t *seed)
+{
+  static const char *loader_names[] = {"strtok", "blocks"};
+
+  struct report_store rs;
+  if (report_store_init(&rs)) {
+    return 1;
+  }
+
+  if (bench_fill_store(&rs, total, seed)) {
+    report_store_cleanup(&rs);
+    return 1;
+  }
+
+  size_t size;
+  char *text = bench_write_text(&rs, &size);
+  if (text == NULL) {
+    report_store_cleanup(&rs);
+    return 1;
+  }
+
+  long long num_reports = rs.num_reports;
+  long long num_levels = rs.num_levels;
+
+  double baseline = 0.0;
+  double best;
+  double start;
+  double elapsed;
+  double rate;
+  FILE *f;
+  int ret = 0;
+
+  printf("\n%-8s %18s %10s %10s\n", "loader", "GB/s", "speedup", "reports");
+
+  // Speedups are relative to the original loader
+  for (int l = 0; (l < 2) && (ret == 0); l++) {
+    best = 0.0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+      report_store_clear(&rs);
+
+      if (l == 0) {
+        f = fmemopen(text, size, "r");
+        if (f == NULL) {
+          ret = 1;
+          break;
+        }
+
+        start = bench_now();
+        ret = tokenize_reports_strtok(f, &rs);
+        elapsed = bench_now() - start;
+
+        fclose(f);
+      }
+      else {
+        start = bench_now();
+        ret = tokenize_reports(text, size, &rs);
+        elapsed = bench_now() - start;
+      }
+
+      // Both loaders have to read back exactly what was written
+      if (ret || (rs.num_reports != num_reports) || (rs.num_levels != num_levels)) {
+        ret = 1;
+        break;
+      }
+
+      if ((r == 0) || (elapsed < best)) {
+        best = elapsed;
+      }
+    }
+
+    if (ret) {
+      break;
+    }
+
+    rate = (double)size / 1e9 / ((best > 0.0) ? best : 1e-9);
+    if (l == 0) {
+      baseline = rate;
+    }
+
+    printf("%-8s %18.2f %9.2fx %10lld\n", loader_names[l], rate, rate / baseline, rs.num_reports);
+  }
+
+  free(text);
+  report_store_cleanup(&rs);
+
+  return ret;
+}
+
+// Write reports holding about `total` levels to a temporary
+//  file and time a full count of it with 1, 2, 4 and so on up
+//  to `threads` threads. Return nonzero on failure.
+static int bench_threads(long long total, uint32_t *seed, int threads)
+{
+  struct report_store rs;
+  if (report_store_init(&rs)) {
+    return 1;
+  }
+
+  if (bench_fill_store(&rs, total, seed)) {
+    report_store_cleanup(&rs);
+    return 1;
+  }
+
+  size_t size;
+  char *text = bench_write_text(&rs, &size);
+  report_store_cleanup(&rs);
+
+  if (text == NULL) {
+    return 1;
+  }
+
+  FILE *f = tmpfile();
+  if (f == NULL) {
+    free(text);
+    return 1;
+  }
+
+  int ret = (fwrite(text, 1, size, f) != size) || (fflush(f) != 0);
+  free(text);
+
+  // The count maps its input by name, which the open temporary
+  //  file has through /dev/fd
+  char path[32];
+  snprintf(path, sizeof(path), "/dev/fd/%d", fileno(f));
+
+  batch_kernel kernel = report_batch_select_kernel();
+  double baseline = 0.0;
+  double best;
+  double start;
+  double elapsed;
+  double rate;
+  long long safe = 0;
+  long long single_safe = 0;
+
+  if (ret == 0) {
+    printf("\n%-8s %18s %10s %10s\n", "threads", "MB/s", "speedup", "safe");
+  }
+
+  // Speedups are relative to one thread. The thread counts
+  //  double up to `threads`, which is always timed last.
+  int t = 1;
+  while (ret == 0) {
+    best = 0.0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+      safe = 0;
+
+      start = bench_now();
+      ret = parallel_count(path, t, kernel, 1, &safe);
+      elapsed = bench_now() - start;
+
+      if (ret) {
+        break;
+      }
+
+      if ((r == 0) || (elapsed < best)) {
+        best = elapsed;
+      }
+    }
+
+    // Every thread count has to agree with one thread
+    if (t == 1) {
+      single_safe = safe;
+    }
+    else if (safe != single_safe) {
+      ret = 1;
+    }
+
+    if (ret) {
+      break;
+    }
+
+    rate = (double)size / (1024.0 * 1024.0) / ((best > 0.0) ? best : 1e-9);
+    if (t == 1) {
+      baseline = rate;
+    }
+
+    printf("%-8d %18.1f %9.2fx %10lld\n", t, rate, rate / baseline, safe);
+
+    if (t == threads) {
+      break;
+    }
+
+    t = ((t * 2) < threads) ? (t * 2) : threads;
+  }
+
+  fclose(f);
+
+  return ret;
+}
+
+int run_benchmark(int size_mb, int threads)
+{
+  static const int lengths[] = {10, 100, 1000};
+  static const int longest = 1000;
+
+  // A level takes about three bytes as text
+  long long total = (long long)size_mb * 1024 * 1024 / 3;
+  if (total < longest) {
+    total = longest;
+  }
+
+  int *levels = malloc(sizeof(int) * total);
+  int *scratch = malloc(sizeof(int) * longest);
+
+  if ((levels == NULL) || (scratch == NULL)) {
+    free(levels);
+    free(scratch);
+    return 1;
+  }
+
+  uint32_t seed = 0x2024u;
+  double ns[2];
+  double start;
+  double elapsed;
+  long long safe[2];
+  const int *level;
+  int count;
+  int ret = 0;
+
+  printf("%-8s %18s %18s %10s %10s\n", "levels", "brute ns/report", "linear ns/report",
+         "speedup", "safe");
+
+  for (size_t n = 0; n < (sizeof(lengths) / sizeof(lengths[0])); n++) {
+    count = (int)(total / lengths[n]);
+    bench_fill_reports(levels, count, lengths[n], &seed);
+
+    // Keep the fastest of a few runs of each check to cut down
+    //  on noise
+    for (int m = 0; m < 2; m++) {
+      for (int r = 0; r < BENCH_REPEATS; r++) {
+        safe[m] = 0;
+
+        start = bench_now();
+        for (int i = 0; i < count; i++) {
+          level = &levels[(size_t)i * lengths[n]];
+
+          if (report_is_safe(level, lengths[n]) ||
+              ((m == 0) ? report_is_safe_brute(level, lengths[n], scratch) :
+                          report_is_safe_dampened(level, lengths[n])))
+          {
+            safe[m]++;
+          }
+        }
+        elapsed = bench_now() - start;
+
+        if ((r == 0) || ((elapsed * 1e9 / count) < ns[m])) {
+          ns[m] = elapsed * 1e9 / count;
+        }
+      }
+    }
+
+    // Both checks have to agree on every report
+    if (safe[0] != safe[1]) {
+      ret = 1;
+      break;
+    }
+
+    printf("%-8d %18.1f %18.1f %9.2fx %10lld\n", lengths[n], ns[0], ns[1],
+           ns[0] / ((ns[1] > 0.0) ? ns[1] : 1e-9), safe[1]);
+  }
+
+  free(levels);
+  free(scratch);
+
+  if (ret == 0) {
+    ret = bench_batch_kernels(total, &seed);
+  }
+
+  if (ret == 0) {
+    ret = bench_tokenizer(total, &seed);
+  }
+
+  if ((ret == 0) && (threads > 1)) {
+    ret = bench_threads(total, &seed, threads);
+  }
+
+  return ret;
 }
@@ -1,108 +1,683 @@
+/*
+*   Advent of Code Day 4
+*
+*   Link: https://adventofcode.com/2024/day/4
+*
+*   Part One:
+*   Given a grid of letters, count every occurrence of the word
+*    XMAS. Words can run horizontally, vertically or
+*    diagonally, and forwards or backwards, so there are eight
+*    directions to look in.
+*   The grid is sized from the file and stored with a few
+*    cells of padding on every side so a search can step off
+*    the edge without checking bounds.
+*   The original search walks every row, column and diagonal
+*    once and feeds the letters through a small state machine
+*    that recognizes both XMAS and SAMX, which covers the two
+*    directions along each line.
+*
+*   The default search works on bitboards instead. For each of
+*    the four letters, every row becomes a bitmap with one bit
+*    per column that's set where that letter is. A word
+*    starting at some cell and running in some direction is
+*    then the AND of four bitmaps, one per letter, each taken
+*    from the right row and shifted by the right number of
+*    columns. Shifting and ANDing whole words checks 64 cells
+*    at once (256 with AVX2, 512 with AVX-512), and a popcount
+*    of the result counts the matches. Looking for XMAS and
+*    SAMX from each cell across, down and along both diagonals
+*    covers all eight directions, and every match is counted
+*    at whichever of its two ends comes first in the grid.
+*   Passing `-e traversal` runs the original search instead.
+*    Its column and diagonal walks jump a whole row ahead with
+*    every step, which misses the cache constantly once the
+*    grid outgrows it.
+*   `-e fused` runs a middle ground that looks at the letters
+*    directly but makes a single row-major pass. Every cell is
+*    checked as the last letter of a word that reaches it from
+*    the left, from above, or diagonally from above, so only
+*    the current row and the three before it are ever looked
+*    at. Those few rows stay in cache, so each byte of the
+*    grid is only brought in from memory once.
+*
+*   Passing `-j N` splits the grid into horizontal tiles of up
+*    to 256 rows and deals them out to N threads. A match
+*    belongs to the tile holding the cell it starts at, its end
+*    that comes first in the grid, so each tile also reads the
+*    three rows below it to finish the matches that start near
+*    its bottom edge, but only counts the ones it owns. Every
+*    thread keeps its own search state, and the bitboards are
+*    built a tile at a time, so tiles don't share anything but
+*    the letters.
+*
+*   Nothing but the total is kept by default. `-r count` also
+*    prints how many matches run in each direction, `-r list`
+*    prints where each match starts and which way it runs, and
+*    `-r map` redraws the grid with only the matched letters
+*    left in it. The searches only look for somewhere to put a
+*    match when one of these is asked for, so plain counting
+*    never pays for it. With `-j`, each thread keeps its own
+*    list and they're combined once all of them are done.
+*
+*   Passing `-w FILE` looks for every word listed in FILE, one
+*    per line, instead of just XMAS, and prints how many times
+*    each one appears. All of the words and their reverses go
+*    into one Aho-Corasick automaton, a DFA that's in a state
+*    for the longest tail of the letters so far that starts
+*    some word, so every word is found in a single pass along
+*    each line no matter how many there are. Rows, columns
+*    and both kinds of diagonal each run their own copy of the
+*    automaton, but they all advance together in one row-major
+*    pass over the grid.
+*
+*   `-B N` times every search on a random N by N grid.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
 
-#define NUM_ROWS  (140)
-#define NUM_COLS  (140)
+// Every row is surrounded by this many cells of padding, as
+//  are the top and bottom of the grid. XMAS is four letters
+//  long, so three cells is enough for a scan in any direction
+//  to step off the edge without checking bounds.
+#define GRID_BORDER  (3)
 
-// Plus one for terminating null character
-#define SIZE_ROWS (NUM_ROWS + 1)
-#define SIZE_COLS (NUM_COLS + 1)
+// Non-letter value the padding is filled with
+#define GRID_SENTINEL  ('.')
+
+// Rows start on a multiple of this many bytes
+#define GRID_ALIGN  (64)
 
 struct crossword_search {
-  char crossword[SIZE_ROWS][SIZE_COLS];
-  char map[SIZE_ROWS][SIZE_COLS];
+  int rows;
+  int cols;
+
+  // Bytes from the start of one row to the next
+  size_t stride;
+
+  // Letters of the crossword with their padding; see
+  //  `crossword_index()`
+  char *crossword;
+  size_t size;
+};
+
+// Allocate a `rows` by `cols` grid filled with GRID_SENTINEL.
+//  Return nonzero on failure.
+int crossword_alloc(struct crossword_search *cs, size_t rows, size_t cols);
+
+// Read the crossword in `filename`, sizing the grid to fit.
+//  Return nonzero if the file can't be read or its rows aren't
+//  all the same length.
+int crossword_load(struct crossword_search *cs, const char *filename);
+void crossword_cleanup(struct crossword_search *cs);
+
+// Return the offset of the cell at `row`, `col` in the grid.
+//  Rows and columns up to GRID_BORDER outside the crossword
+//  are valid and hold GRID_SENTINEL.
+static inline size_t crossword_index(const struct crossword_search *cs, int row, int col)
+{
+  return ((size_t)(row + GRID_BORDER) * cs->stride) + (size_t)(col + GRID_BORDER);
+}
+
+// Letters of XMAS, in order; each gets its own bitboard plane
+enum bitboard_letter {
+  BB_X,
+  BB_M,
+  BB_A,
+  BB_S,
+  BB_LETTERS
+};
+
+// The number of 64-bit words in a bitboard row is rounded up
+//  to a multiple of this, enough for one AVX-512 vector.
+#define BITBOARD_LANES  (8)
+
+// One bit per cell for each letter. Bit `c % 64` of word
+//  `c / 64` in a row is column `c`.
+struct bitboard {
+  // Rows of crossword each plane has room for
+  int rows;
+  int cols;
+
+  // Words of crossword in each row, and the distance from one
+  //  row to the next, which adds a zero word on either side
+  //  so shifts can borrow bits from beyond the edge.
+  size_t words;
+  size_t stride;
+
+  // Each letter's plane has GRID_BORDER zero rows below the
+  //  crossword, so the vertical and diagonal checks can read
+  //  past the bottom; see `bitboard_row()`.
+  uint64_t *bits;
+  size_t size;
+};
+
+// Allocate bitboards with room for `rows` rows of `cs`.
+//  Return nonzero on failure.
+int bitboard_init(struct bitboard *bb, const struct crossword_search *cs, int rows);
+void bitboard_cleanup(struct bitboard *bb);
+
+// Fill in the bitboards from rows `row_begin` up to `row_end`
+//  of `cs`, which become bitboard rows 0 onward, and clear the
+//  GRID_BORDER rows after them.
+void bitboard_fill(struct bitboard *bb, const struct crossword_search *cs, int row_begin, int row_end);
+
+// Return the first crossword word of `row` in `letter`'s plane
+static inline uint64_t *bitboard_row(const struct bitboard *bb, int letter, int row)
+{
+  return &bb->bits[((((size_t)letter * (size_t)(bb->rows + GRID_BORDER)) + (size_t)row) * bb->stride) + 1];
+}
+
+// Count the matches that start in rows `row_begin` up to
+//  `row_end`, each kernel checking as many words at once as
+//  its instruction set allows.
+typedef long long (*bitboard_kernel)(const struct bitboard *bb, int row_begin, int row_end);
+
+long long bitboard_count_scalar(const struct bitboard *bb, int row_begin, int row_end);
+#ifdef HAVE_X86_KERNELS
+long long bitboard_count_avx2(const struct bitboard *bb, int row_begin, int row_end);
+long long bitboard_count_avx512(const struct bitboard *bb, int row_begin, int row_end);
+#endif
+
+// Return the fastest kernel the CPU supports
+bitboard_kernel bitboard_select_kernel(void);
+
+enum search_engine {
+  ENGINE_TRAVERSAL,
+  ENGINE_FUSED,
+  ENGINE_BITBOARD,
+  ENGINES
+};
+
+// What a search keeps of its matches besides the total
+enum record_mode {
+  RECORD_NONE,
+  RECORD_COUNT,
+  RECORD_LIST,
+  RECORD_MAP
+};
+
+// The way a match reads, from its X to its S
+enum direction {
+  DIR_E,
+  DIR_W,
+  DIR_S,
+  DIR_N,
+  DIR_SE,
+  DIR_NW,
+  DIR_SW,
+  DIR_NE,
+  DIRECTIONS
+};
+
+// A match, as the cell its X is in and the way it reads
+struct match {
+  int row;
+  int col;
+  int direction;
+};
+
+// Where a search records its matches. Only the part for its
+//  mode is used: a tally for each direction, a list of every
+//  match, or a `rows` by `cols` map of the letters that are
+//  part of some match.
+struct match_sink {
+  enum record_mode mode;
+
+  long long direction_count[DIRECTIONS];
+
+  struct match *list;
+  size_t len;
+  size_t capacity;
+
+  char *map;
+  int rows;
+  int cols;
+
+  // Set if the list couldn't grow
+  bool failed;
+};
+
+// Set up `sink` to record matches in a `rows` by `cols` grid.
+//  Return nonzero on failure.
+int match_sink_init(struct match_sink *sink, enum record_mode mode, int rows, int cols);
+void match_sink_cleanup(struct match_sink *sink);
+
+// Record the match whose X is at `row`, `col`
+void match_sink_record(struct match_sink *sink, int row, int col, enum direction direction);
+
+// Record everything `src` has in `dst` too. A list can be
+//  merged into a map.
+void match_sink_merge(struct match_sink *dst, const struct match_sink *src);
+void match_sink_print(const struct match_sink *sink);
+
+// Everything a search keeps track of as it goes. Each thread
+//  gets its own, so any number of searches can run at once.
+struct search_context {
+  enum search_engine engine;
+
+  // Where the traversal's state machine is up to, and the
+  //  row and column of the latest X, M, A and S it has seen
   int state;
+  int idx[4][2];
+
+  // Where matches are recorded, or NULL to only count them
+  struct match_sink *sink;
+
+  // Bitboards for the rows being searched
+  struct bitboard bb;
+  bitboard_kernel kernel;
+};
+
+// Set up `ctx` to search up to `rows` rows of `cs` at a time,
+//  recording matches in `sink` unless it's NULL or records
+//  nothing. Return nonzero on failure.
+int search_context_init(struct search_context *ctx, const struct crossword_search *cs,
+                        enum search_engine engine, int rows, struct match_sink *sink);
+void search_context_cleanup(struct search_context *ctx);
+
+bool crossword_search_update(struct search_context *ctx, char letter, int row, int col);
+void crossword_search_reset_state(struct search_context *ctx);
+long long crossword_search_diagonal(const struct crossword_search *cs, struct search_context *ctx,
+                                    int row_begin, int row_end);
+long long crossword_search_off_diagonal(const struct crossword_search *cs, struct search_context *ctx,
+                                        int row_begin, int row_end);
+
+// Every search below counts the matches that start in rows
+//  `row_begin` up to `row_end`, where a match starts at
+//  whichever of its ends comes first in the grid. They look
+//  at most GRID_BORDER rows further down to do it, and record
+//  what they count in the sink they're given, if any.
+
+// Count XMAS by walking every column, row and diagonal
+//  through the state machine.
+long long crossword_count_traversal(const struct crossword_search *cs, struct search_context *ctx,
+                                    int row_begin, int row_end);
+
+// Count XMAS in a single row-major pass, looking back over a
+//  window of the current row and the three before it.
+long long crossword_count_fused(const struct crossword_search *cs, int row_begin, int row_end,
+                                struct match_sink *sink);
+
+// Count the same matches as `bitboard_count_scalar()`, but
+//  also record each one in `sink`. Bitboard row 0 is row
+//  `row_offset` of the crossword.
+long long bitboard_record(const struct bitboard *bb, int row_begin, int row_end, int row_offset,
+                          struct match_sink *sink);
+
+// Count XMAS with bitboards. Recording the matches takes the
+//  scalar path, which can pick out each one's cell.
+long long crossword_count_bitboard(const struct crossword_search *cs, struct search_context *ctx,
+                                   int row_begin, int row_end);
+
+// Count XMAS with `ctx`'s engine
+long long crossword_count_rows(const struct crossword_search *cs, struct search_context *ctx,
+                               int row_begin, int row_end);
+
+// Count XMAS in the whole grid with `engine`, recording the
+//  matches in `sink` if it isn't NULL. Return -1 on failure.
+long long crossword_count(struct crossword_search *cs, enum search_engine engine,
+                          struct match_sink *sink);
+
+#define MAX_THREADS  (256)
+
+// Tiles are at most this many rows tall
+#define TILE_ROWS  (256)
+
+// One thread's share of the tiles: every `step`th tile,
+//  starting from `first`
+struct tile_job {
+  const struct crossword_search *cs;
+  enum search_engine engine;
+  int tile_rows;
+  int first;
+  int step;
+  struct match_sink sink;
+  long long xmas_count;
+  int ret;
+};
+
+void *tile_worker(void *arg);
+
+// Count XMAS with `engine` on `threads` threads. The grid is
+//  split into horizontal tiles that are handed out in turn.
+//  Each thread records matches on its own and they're merged
+//  into `sink`, if it isn't NULL, at the end. Return -1 on
+//  failure.
+long long parallel_count(const struct crossword_search *cs, enum search_engine engine, int threads,
+                         struct match_sink *sink);
+
+// Longest word a word list can hold
+#define WORD_MAX_LEN  (64)
+
+// Searches for any number of words at once with an
+//  Aho-Corasick automaton built over every word and its
+//  reverse. Add the words, build it, then count.
+struct word_search {
+  char **word;
+  int words;
+  int capacity;
+
+  // Automaton states. State 0 is the start; `next` has a row
+  //  of `classes` entries for each one. Only the letters that
+  //  appear in some word get a class of their own; every other
+  //  byte is class 0.
+  int states;
+  int classes;
+  uint8_t letter_class[256];
+  int *next;
+
+  // `match[s]` is the first state along the chain of `s` and
+  //  its suffixes where some word ends, and `report[s]` the
+  //  next one after `s`; 0 ends the chain.
+  int *match;
+  int *report;
+
+  // Words ending at each state: `ends[s]` indexes the first of
+  //  a list in `end_word` and `end_next`, or is -1.
+  int *ends;
+  int *end_word;
+  int *end_next;
+  int end_count;
 };
 
-bool crossword_search_update(struct crossword_search *cs, char letter, int row, int col);
-void crossword_search_reset_state(struct crossword_search *cs);
-int crossword_search_diagonal(struct crossword_search *cs);
-int crossword_search_off_diagonal(struct crossword_search *cs);
-void crossword_print_map(struct crossword_search *cs);
+void word_search_init(struct word_search *ws);
+void word_search_cleanup(struct word_search *ws);
+
+// Add `word` to the words to search for. Return nonzero if
+//  it's shorter than two letters, longer than WORD_MAX_LEN or
+//  can't be stored.
+int word_search_add(struct word_search *ws, const char *word);
+
+// Add every line of `filename` as a word, skipping blank ones.
+//  Return nonzero on failure.
+int word_search_load(struct word_search *ws, const char *filename);
+
+// Build the automaton from the words added so far. Return
+//  nonzero on failure.
+int word_search_build(struct word_search *ws);
+
+// Set `counts[i]` to the number of times word `i` appears in
+//  `cs`, in any of the eight directions. Return nonzero on
+//  failure.
+int word_search_count(const struct word_search *ws, const struct crossword_search *cs,
+                      long long *counts);
+
+// Search `cs` for every word in `filename` and print how many
+//  times each one appears. Return nonzero on failure.
+int run_word_search(const struct crossword_search *cs, const char *filename);
+
+#define BENCH_REPEATS  (3)
+
+// Time every engine on a random `size` by `size` grid, using
+//  `threads` threads. Return nonzero on failure.
+int run_benchmark(int size, int threads);
 
 int main(int argc, char *argv[])
 {
-  if (argc < 2) {
+  enum search_engine engine = ENGINE_BITBOARD;
+  int threads = 1;
+  enum record_mode record = RECORD_NONE;
+  int bench_size = 0;
+  char *word_file = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:j:r:w:B:")) != -1) {
+    switch (opt) {
+      case 'e':
+        if (strcmp(optarg, "bitboard") == 0) {
+          engine = ENGINE_BITBOARD;
+        }
+        else if (strcmp(optarg, "fused") == 0) {
+          engine = ENGINE_FUSED;
+        }
+        else if (strcmp(optarg, "traversal") == 0) {
+          engine = ENGINE_TRAVERSAL;
+        }
+        else {
+          printf("Unknown engine '%s'\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+
+      case 'j':
+        threads = atoi(optarg);
+        break;
+
+      case 'r':
+        if (strcmp(optarg, "none") == 0) {
+          record = RECORD_NONE;
+        }
+        else if (strcmp(optarg, "count") == 0) {
+          record = RECORD_COUNT;
+        }
+        else if (strcmp(optarg, "list") == 0) {
+          record = RECORD_LIST;
+        }
+        else if (strcmp(optarg, "map") == 0) {
+          record = RECORD_MAP;
+        }
+        else {
+          printf("Unknown record mode '%s'\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+
+      case 'w':
+        word_file = optarg;
+        break;
+
+      case 'B':
+        bench_size = atoi(optarg);
+        break;
+
+      default:
+        printf("Usage: %s [-e bitboard|fused|traversal] [-j threads]\n"
+               "          [-r none|count|list|map] file\n"
+               "       %s -w word_file file\n"
+               "       %s -B size [-j threads]\n", argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (threads < 1)            threads = 1;
+  if (threads > MAX_THREADS)  threads = MAX_THREADS;
+
+  if (bench_size > 0) {
+    if (run_benchmark(bench_size, threads)) {
+      printf("Zoinks\n");
+      return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind >= argc) {
     printf("Missing file name in second argument position\n");
     return EXIT_FAILURE;
   }
 
-  char *filename = argv[1];
-  FILE *f = fopen(filename, "r");
+  char *filename = argv[optind];
 
-  if (f == NULL) {
+  struct crossword_search cs;
+
+  if (crossword_load(&cs, filename)) {
     printf("Zoinks\n");
     return EXIT_FAILURE;
   }
 
-  struct crossword_search cs;
-  cs.state = 0b0000;
+  if (word_file != NULL) {
+    int ret = run_word_search(&cs, word_file);
 
-  for (int r = 0; r < NUM_ROWS; r++) {
-    for (int c = 0; c < NUM_COLS; c++) {
-      cs.map[r][c] = '.';
+    if (ret) {
+      printf("Zoinks\n");
     }
+
+    crossword_cleanup(&cs);
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
   }
 
-  int row = 0;
-  while (fgets(&cs.crossword[row][0], SIZE_ROWS, f)) {
-    // Discard trailing newline character at end
-    //  of each row.
-    (void)fgetc(f);
+  struct match_sink sink;
 
-    row++;
+  if (match_sink_init(&sink, record, cs.rows, cs.cols)) {
+    printf("Zoinks\n");
+    crossword_cleanup(&cs);
+    return EXIT_FAILURE;
   }
 
-  int xmas_count = 0;
-  char letter;
+  long long xmas_count = (threads > 1) ?
+                         parallel_count(&cs, engine, threads, &sink) :
+                         crossword_count(&cs, engine, &sink);
 
-  // Traverse vertically downward each column
-  for (int c = 0; c < NUM_COLS; c++) {
-    for (int r = 0; r < NUM_ROWS; r++) {
-      letter = cs.crossword[r][c];
+  if ((xmas_count < 0) || sink.failed) {
+    printf("Zoinks\n");
+    match_sink_cleanup(&sink);
+    crossword_cleanup(&cs);
+    return EXIT_FAILURE;
+  }
 
-      if (crossword_search_update(&cs, letter, r, c)) {
-        xmas_count++;
-      }
-    }
+  printf("XMAS count: %lld\n", xmas_count);
+
+  match_sink_print(&sink);
+
+  match_sink_cleanup(&sink);
+  crossword_cleanup(&cs);
+
+  return EXIT_SUCCESS;
+}
 
-    crossword_search_reset_state(&cs);
+int crossword_alloc(struct crossword_search *cs, size_t rows, size_t cols)
+{
+  if ((rows == 0) || (rows > (INT_MAX / 2)) || (cols > (INT_MAX / 2))) {
+    return 1;
   }
 
-  // Traverse horizontally across each row left-to-right
-  for (int r = 0; r < NUM_ROWS; r++) {
-    for (int c = 0; c < NUM_COLS; c++) {
-      letter = cs.crossword[r][c];
+  cs->rows = (int)rows;
+  cs->cols = (int)cols;
+  cs->stride = ((cols + (2 * GRID_BORDER) + GRID_ALIGN - 1) / GRID_ALIGN) * GRID_ALIGN;
+  cs->size = cs->stride * (rows + (2 * GRID_BORDER));
 
-      if (crossword_search_update(&cs, letter, r, c)) {
-        xmas_count++;
+  cs->crossword = mmap(NULL, cs->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (cs->crossword == MAP_FAILED) {
+    cs->crossword = NULL;
+    return 1;
+  }
+
+  memset(cs->crossword, GRID_SENTINEL, cs->size);
+
+  return 0;
+}
+
+int crossword_load(struct crossword_search *cs, const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return 1;
+  }
+
+  struct stat st;
+  if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+    close(fd);
+    return 1;
+  }
+
+  size_t file_size = (size_t)st.st_size;
+  const char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return 1;
+  }
+
+  madvise((void *)data, file_size, MADV_SEQUENTIAL);
+
+  // The first row decides the width; every other row has to
+  //  match it. Blank lines (like a trailing one) are skipped.
+  const char *p = data;
+  const char *end = data + file_size;
+  const char *nl;
+  size_t len;
+  size_t cols = 0;
+  size_t rows = 0;
+
+  while (p < end) {
+    nl = memchr(p, '\n', end - p);
+    if (nl == NULL) nl = end;
+
+    len = nl - p;
+    if ((len > 0) && (p[len - 1] == '\r')) len--;
+
+    if (len > 0) {
+      if (cols == 0) {
+        cols = len;
+      }
+      else if (len != cols) {
+        munmap((void *)data, file_size);
+        return 1;
       }
+
+      rows++;
     }
 
-    crossword_search_reset_state(&cs);
+    p = nl + 1;
   }
 
-  xmas_count += crossword_search_diagonal(&cs);
-  xmas_count += crossword_search_off_diagonal(&cs);
+  if (crossword_alloc(cs, rows, cols)) {
+    munmap((void *)data, file_size);
+    return 1;
+  }
 
-  printf("XMAS count: %d\n", xmas_count);
+  int row = 0;
+  p = data;
 
-  //crossword_print_map(&cs);
+  while (p < end) {
+    nl = memchr(p, '\n', end - p);
+    if (nl == NULL) nl = end;
 
-  return EXIT_SUCCESS;
+    len = nl - p;
+    if ((len > 0) && (p[len - 1] == '\r')) len--;
+
+    if (len > 0) {
+      memcpy(&cs->crossword[crossword_index(cs, row, 0)], p, cols);
+      row++;
+    }
+
+    p = nl + 1;
+  }
+
+  munmap((void *)data, file_size);
+
+  return 0;
 }
 
-bool crossword_search_update(struct crossword_search *cs, char letter, int row, int col)
+void crossword_cleanup(struct crossword_search *cs)
 {
-  static int idx[4][2] = {
-    {0, 0},
-    {0, 0},
-    {0, 0},
-    {0, 0}
-  };
+  if (cs->crossword != NULL) munmap(cs->crossword, cs->size);
 
+  cs->crossword = NULL;
+  cs->size = 0;
+}
+
+bool crossword_search_update(struct search_context *ctx, char letter, int row, int col)
+{
+  int (*idx)[2] = ctx->idx;
   bool match = false;
 
   switch (letter) {
@@ -110,130 +685,151 @@ bool crossword_search_update(struct crossword_search *cs, char letter, int row,
       idx[0][0] = row;
       idx[0][1] = col;
 
-      if (cs->state == 0b1110)  cs->state = 0b1111;
-      else                      cs->state = 0b0001;
+      if (ctx->state == 0b1110)  ctx->state = 0b1111;
+      else                      ctx->state = 0b0001;
       break;
 
     case 'M':
       idx[1][0] = row;
       idx[1][1] = col;
 
-      if (cs->state == 0b0001)       cs->state = 0b0011;
-      else if (cs->state == 0b1100)  cs->state = 0b1110;
-      else                       cs->state = 0b0000;
+      if (ctx->state == 0b0001)       ctx->state = 0b0011;
+      else if (ctx->state == 0b1100)  ctx->state = 0b1110;
+      else                       ctx->state = 0b0000;
       break;
 
     case 'A':
       idx[2][0] = row;
       idx[2][1] = col;
 
-      if (cs->state == 0b0011)       cs->state = 0b0111;
-      else if (cs->state == 0b1000)  cs->state = 0b1100;
-      else                       cs->state = 0b0000;
+      if (ctx->state == 0b0011)       ctx->state = 0b0111;
+      else if (ctx->state == 0b1000)  ctx->state = 0b1100;
+      else                       ctx->state = 0b0000;
       break;
 
     case 'S':
       idx[3][0] = row;
       idx[3][1] = col;
 
-      if (cs->state == 0b0111)  cs->state = 0b1111;
-      else                      cs->state = 0b1000;
+      if (ctx->state == 0b0111)  ctx->state = 0b1111;
+      else                      ctx->state = 0b1000;
       break;
 
     default:
-      cs->state = 0b0000;
+      ctx->state = 0b0000;
       break;
   };
 
-  if (cs->state == 0b1111) {
+  if (ctx->state == 0b1111) {
     match = true;
 
     // Account for the case where two instances of the word
     //  overlap (e.g.: XMASAMX or SAMXMAS).
     if (letter == 'S') {
-      cs->state = 0b1000;
+      ctx->state = 0b1000;
     }
     else if (letter == 'X') {
-      cs->state = 0b0001;
+      ctx->state = 0b0001;
     }
     else {
-      cs->state = 0b0000;
+      ctx->state = 0b0000;
     }
-
-    cs->map[idx[0][0]][idx[0][1]] = 'X';
-    cs->map[idx[1][0]][idx[1][1]] = 'M';
-    cs->map[idx[2][0]][idx[2][1]] = 'A';
-    cs->map[idx[3][0]][idx[3][1]] = 'S';
   }
 
   return match;
 }
 
-void crossword_search_reset_state(struct crossword_search *cs)
+void crossword_search_reset_state(struct search_context *ctx)
+{
+  ctx->state = 0b0000;
+}
+
+// Return the first row of the match the state machine just
+//  found, from whichever end of it is higher up
+static inline int crossword_search_first_row(const struct search_context *ctx)
+{
+  return (ctx->idx[0][0] < ctx->idx[3][0]) ? ctx->idx[0][0] : ctx->idx[3][0];
+}
+
+// Row and column steps of each direction
+static const int direction_step[DIRECTIONS][2] = {
+  [DIR_E]  = { 0,  1},
+  [DIR_W]  = { 0, -1},
+  [DIR_S]  = { 1,  0},
+  [DIR_N]  = {-1,  0},
+  [DIR_SE] = { 1,  1},
+  [DIR_NW] = {-1, -1},
+  [DIR_SW] = { 1, -1},
+  [DIR_NE] = {-1,  1}
+};
+
+static const char *direction_names[DIRECTIONS] = {
+  "E", "W", "S", "N", "SE", "NW", "SW", "NE"
+};
+
+// Record the match the state machine just found, going by the
+//  step from its X to its M
+static inline void crossword_search_record(struct search_context *ctx)
+{
+  if (ctx->sink == NULL) {
+    return;
+  }
+
+  int row_step = ctx->idx[1][0] - ctx->idx[0][0];
+  int col_step = ctx->idx[1][1] - ctx->idx[0][1];
+
+  for (int d = 0; d < DIRECTIONS; d++) {
+    if ((direction_step[d][0] == row_step) && (direction_step[d][1] == col_step)) {
+      match_sink_record(ctx->sink, ctx->idx[0][0], ctx->idx[0][1], (enum direction)d);
+      return;
+    }
+  }
+}
+
+// Return the row after the last one a search of rows
+//  `row_begin` up to `row_end` needs to look at
+static inline int crossword_search_stop_row(const struct crossword_search *cs, int row_end)
 {
-  cs->state = 0b0000;
+  return ((row_end + GRID_BORDER) < cs->rows) ? (row_end + GRID_BORDER) : cs->rows;
 }
 
 // Traverse crossword like so:
 // ///
 // ///
 // ///
-int crossword_search_diagonal(struct crossword_search *cs)
+long long crossword_search_diagonal(const struct crossword_search *cs, struct search_context *ctx,
+                                    int row_begin, int row_end)
 {
+  int row_stop = crossword_search_stop_row(cs, row_end);
+  int height = row_stop - row_begin;
   int row;
   int col;
   char letter;
-  int xmas_count = 0;
-  int stripe = 0;
+  long long xmas_count = 0;
 
-  // Traverse diagonally starting from the top of each column
-  for (int i = 0; i < NUM_COLS; i++) {
-    col = i;
-    row = 0;
+  // Each stripe holds the cells where row + col is the same,
+  //  starting from the top row or, once the stripes have
+  //  passed the last column, from the right-hand edge. The
+  //  grid doesn't have to be square.
+  for (int stripe = 0; stripe < (height + cs->cols - 1); stripe++) {
+    row = (stripe < cs->cols) ? 0 : (stripe - cs->cols + 1);
+    col = stripe - row;
+    row += row_begin;
 
-    // Column index determines number of cells in the diagonal
-    //printf("[%d]: ", stripe);
-    for (int j = i; j >= 0; j--) {
-      letter = cs->crossword[row][col];
+    while ((row < row_stop) && (col >= 0)) {
+      letter = cs->crossword[crossword_index(cs, row, col)];
 
-      //printf("%c ", letter);
-      if (crossword_search_update(cs, letter, row, col)) {
+      if (crossword_search_update(ctx, letter, row, col) &&
+          (crossword_search_first_row(ctx) < row_end)) {
         xmas_count++;
+        crossword_search_record(ctx);
       }
 
       row++;
       col--;
     }
-    //printf("\n");
-
-    crossword_search_reset_state(cs);
-    stripe++;
-  }
-
-  // The previous loop only traverses the diagonals starting
-  //  from the top of each column. Now, we need to traverse
-  //  the remaining diagonals in the bottom portion of the
-  //  matrix.
-  for (int i = 0; i < (NUM_ROWS - 1); i++) {
-    col = NUM_COLS - 1 - i;
-    row = NUM_ROWS - 1;
-
-    //printf("[%d] ", stripe);
-    for (int j = i; j >= 0; j--) {
-      letter = cs->crossword[row][col];
-
-      //printf("%c ", letter);
-      if (crossword_search_update(cs, letter, row, col)) {
-        xmas_count++;
-      }
-
-      row--;
-      col++;
-    }
-    //printf("\n");
 
-    crossword_search_reset_state(cs);
-    stripe++;
+    crossword_search_reset_state(ctx);
   }
 
   return xmas_count;
@@ -244,72 +840,1241 @@ int crossword_search_diagonal(struct crossword_search *cs)
 // \\\
 // \\\
 //
-int crossword_search_off_diagonal(struct crossword_search *cs)
+long long crossword_search_off_diagonal(const struct crossword_search *cs, struct search_context *ctx,
+                                        int row_begin, int row_end)
 {
+  int row_stop = crossword_search_stop_row(cs, row_end);
+  int height = row_stop - row_begin;
   int row;
   int col;
   char letter;
-  int xmas_count = 0;
-  int stripe = 0;
+  long long xmas_count = 0;
 
-  // Traverse diagonally starting from the first element of each
-  //  row.
-  for (int i = (NUM_ROWS - 1); i >= 0; i--) {
-    col = 0;
-    row = i;
+  // Each stripe holds the cells where col - row is the same,
+  //  starting from the first column for the bottom-left
+  //  stripes and from the top row for the rest.
+  for (int stripe = -(height - 1); stripe < cs->cols; stripe++) {
+    row = (stripe < 0) ? -stripe : 0;
+    col = row + stripe;
+    row += row_begin;
 
-    //printf("[%d]: ", stripe);
-    for (int j = (NUM_ROWS - 1 - i); j >= 0; j--) {
-      letter = cs->crossword[row][col];
+    while ((row < row_stop) && (col < cs->cols)) {
+      letter = cs->crossword[crossword_index(cs, row, col)];
 
-      //printf("%c ", letter);
-      if (crossword_search_update(cs, letter, row, col)) {
+      if (crossword_search_update(ctx, letter, row, col) &&
+          (crossword_search_first_row(ctx) < row_end)) {
         xmas_count++;
+        crossword_search_record(ctx);
       }
 
       row++;
       col++;
     }
-    //printf("\n");
 
-    crossword_search_reset_state(cs);
-    stripe++;
+    crossword_search_reset_state(ctx);
+  }
+
+  return xmas_count;
+}
+
+int match_sink_init(struct match_sink *sink, enum record_mode mode, int rows, int cols)
+{
+  memset(sink, 0, sizeof(*sink));
+  sink->mode = mode;
+  sink->rows = rows;
+  sink->cols = cols;
+
+  // Only a map costs anything up front
+  if (mode == RECORD_MAP) {
+    size_t size = (size_t)rows * (size_t)cols;
+
+    sink->map = malloc(size);
+    if (sink->map == NULL) {
+      return 1;
+    }
+
+    memset(sink->map, '.', size);
+  }
+
+  return 0;
+}
+
+void match_sink_cleanup(struct match_sink *sink)
+{
+  free(sink->list);
+  free(sink->map);
+
+  sink->list = NULL;
+  sink->map = NULL;
+  sink->len = 0;
+  sink->capacity = 0;
+}
+
+void match_sink_record(struct match_sink *sink, int row, int col, enum direction direction)
+{
+  switch (sink->mode) {
+    case RECORD_COUNT:
+      sink->direction_count[direction]++;
+      break;
+
+    case RECORD_LIST:
+      if (sink->len == sink->capacity) {
+        size_t capacity = (sink->capacity == 0) ? 1024 : (sink->capacity * 2);
+        struct match *grown = realloc(sink->list, capacity * sizeof(struct match));
+
+        if (grown == NULL) {
+          sink->failed = true;
+          return;
+        }
+
+        sink->list = grown;
+        sink->capacity = capacity;
+      }
+
+      sink->list[sink->len].row = row;
+      sink->list[sink->len].col = col;
+      sink->list[sink->len].direction = direction;
+      sink->len++;
+      break;
+
+    case RECORD_MAP:
+      for (int i = 0; i < 4; i++) {
+        sink->map[((size_t)(row + (i * direction_step[direction][0])) * (size_t)sink->cols) +
+                  (size_t)(col + (i * direction_step[direction][1]))] = "XMAS"[i];
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void match_sink_merge(struct match_sink *dst, const struct match_sink *src)
+{
+  for (int d = 0; d < DIRECTIONS; d++) {
+    dst->direction_count[d] += src->direction_count[d];
+  }
+
+  for (size_t i = 0; i < src->len; i++) {
+    match_sink_record(dst, src->list[i].row, src->list[i].col, (enum direction)src->list[i].direction);
+  }
+
+  dst->failed = dst->failed || src->failed;
+}
+
+void match_sink_print(const struct match_sink *sink)
+{
+  switch (sink->mode) {
+    case RECORD_COUNT:
+      for (int d = 0; d < DIRECTIONS; d++) {
+        printf("%-2s %lld\n", direction_names[d], sink->direction_count[d]);
+      }
+      break;
+
+    case RECORD_LIST:
+      for (size_t i = 0; i < sink->len; i++) {
+        printf("%d %d %s\n", sink->list[i].row, sink->list[i].col,
+               direction_names[sink->list[i].direction]);
+      }
+      break;
+
+    case RECORD_MAP:
+      for (int r = 0; r < sink->rows; r++) {
+        fwrite(&sink->map[(size_t)r * (size_t)sink->cols], 1, (size_t)sink->cols, stdout);
+        printf("\n");
+      }
+      break;
+
+    default:
+      break;
   }
+}
+
+long long crossword_count_traversal(const struct crossword_search *cs, struct search_context *ctx,
+                                    int row_begin, int row_end)
+{
+  int row_stop = crossword_search_stop_row(cs, row_end);
+  long long xmas_count = 0;
+  char letter;
 
-  // The previous loop only traverses the bottom triangular
-  //  portion of the matrix. Now, we need to traverse the
-  //  remaining diagonals starting from column at index 1.
-  for (int i = 1; i < NUM_COLS; i++) {
-    col = i;
-    row = 0;
+  crossword_search_reset_state(ctx);
 
-    //printf("[%d]: ", stripe);
-    for (int j = 0; j < (NUM_COLS - i); j++) {
-      letter = cs->crossword[row][col];
+  // Traverse vertically downward each column
+  for (int c = 0; c < cs->cols; c++) {
+    for (int r = row_begin; r < row_stop; r++) {
+      letter = cs->crossword[crossword_index(cs, r, c)];
 
-      //printf("%c ", letter);
-      if (crossword_search_update(cs, letter, row, col)) {
+      if (crossword_search_update(ctx, letter, r, c) &&
+          (crossword_search_first_row(ctx) < row_end)) {
         xmas_count++;
+        crossword_search_record(ctx);
       }
+    }
 
-      row++;
-      col++;
+    crossword_search_reset_state(ctx);
+  }
+
+  // Traverse horizontally across each row left-to-right
+  for (int r = row_begin; r < row_end; r++) {
+    for (int c = 0; c < cs->cols; c++) {
+      letter = cs->crossword[crossword_index(cs, r, c)];
+
+      if (crossword_search_update(ctx, letter, r, c)) {
+        xmas_count++;
+        crossword_search_record(ctx);
+      }
     }
-    //printf("\n");
 
-    crossword_search_reset_state(cs);
-    stripe++;
+    crossword_search_reset_state(ctx);
   }
 
+  xmas_count += crossword_search_diagonal(cs, ctx, row_begin, row_end);
+  xmas_count += crossword_search_off_diagonal(cs, ctx, row_begin, row_end);
+
   return xmas_count;
 }
 
-void crossword_print_map(struct crossword_search *cs)
+// Pack four letters into an integer, first letter lowest
+static inline uint32_t crossword_pack(char a, char b, char c, char d)
 {
-  for (int r = 0; r < NUM_ROWS; r++) {
-    for (int c = 0; c < NUM_COLS; c++) {
-      printf("%c", cs->map[r][c]);
-    }
-    printf("\n");
+  return (uint32_t)(uint8_t)a | ((uint32_t)(uint8_t)b << 8) |
+         ((uint32_t)(uint8_t)c << 16) | ((uint32_t)(uint8_t)d << 24);
+}
+
+// Record whichever of the words packed in `left`, `above`,
+//  `upper_left` and `upper_right` end at `row`, `col` and
+//  belong to the rows being searched
+static void crossword_fused_record(struct match_sink *sink, int row, int col,
+                                   uint32_t left, uint32_t above, uint32_t upper_left,
+                                   uint32_t upper_right, bool across_owned, bool down_owned)
+{
+  const uint32_t xmas = crossword_pack('X', 'M', 'A', 'S');
+  const uint32_t samx = crossword_pack('S', 'A', 'M', 'X');
+
+  if (across_owned) {
+    if (left == xmas)         match_sink_record(sink, row, col - 3, DIR_E);
+    if (left == samx)         match_sink_record(sink, row, col, DIR_W);
+  }
+
+  if (down_owned) {
+    if (above == xmas)        match_sink_record(sink, row - 3, col, DIR_S);
+    if (above == samx)        match_sink_record(sink, row, col, DIR_N);
+    if (upper_left == xmas)   match_sink_record(sink, row - 3, col - 3, DIR_SE);
+    if (upper_left == samx)   match_sink_record(sink, row, col, DIR_NW);
+    if (upper_right == xmas)  match_sink_record(sink, row - 3, col + 3, DIR_SW);
+    if (upper_right == samx)  match_sink_record(sink, row, col, DIR_NE);
   }
 }
+
+// The fused pass itself. It's always inlined into
+//  `crossword_count_fused()` so the copy made for a NULL `sink`
+//  has no trace of the recording left in it.
+static inline __attribute__((always_inline))
+long long crossword_fused_scan(const struct crossword_search *cs, int row_begin, int row_end,
+                               struct match_sink *sink)
+{
+  const uint32_t xmas = crossword_pack('X', 'M', 'A', 'S');
+  const uint32_t samx = crossword_pack('S', 'A', 'M', 'X');
+
+  // `window[k]` is the row `k` rows above the current one. Rows
+  //  above the first are padding, so they never match.
+  const char *window[4];
+  uint32_t left;
+  uint32_t above;
+  uint32_t upper_left;
+  uint32_t upper_right;
+  long long across;
+  long long down;
+  long long xmas_count = 0;
+
+  // A match found here is counted at its last cell, so the
+  //  rows after `row_end` are needed for the ones that start
+  //  just above it. Only the matches that start inside the
+  //  range are kept: across from a row before `row_end`, or
+  //  down from a row ending at least three rows after
+  //  `row_begin`.
+  for (int r = row_begin; r < crossword_search_stop_row(cs, row_end); r++) {
+    for (int k = 0; k < 4; k++) {
+      window[k] = &cs->crossword[crossword_index(cs, r - k, 0)];
+    }
+
+    // Gather the four letters leading up to each cell from
+    //  every direction and compare them against both spellings
+    //  at once. Doing that for every cell, rather than branching
+    //  on whether it holds an X or an S, keeps the loop free of
+    //  hard-to-predict branches.
+    across = 0;
+    down = 0;
+
+    for (int c = 0; c < cs->cols; c++) {
+      left = crossword_pack(window[0][c - 3], window[0][c - 2], window[0][c - 1], window[0][c]);
+      above = crossword_pack(window[3][c], window[2][c], window[1][c], window[0][c]);
+      upper_left = crossword_pack(window[3][c - 3], window[2][c - 2], window[1][c - 1], window[0][c]);
+      upper_right = crossword_pack(window[3][c + 3], window[2][c + 2], window[1][c + 1], window[0][c]);
+
+      across += (left == xmas) + (left == samx);
+      down += (above == xmas) + (above == samx) + (upper_left == xmas) + (upper_left == samx) +
+              (upper_right == xmas) + (upper_right == samx);
+
+      if (sink != NULL) {
+        crossword_fused_record(sink, r, c, left, above, upper_left, upper_right,
+                               r < row_end, r >= (row_begin + 3));
+      }
+    }
+
+    if (r < row_end)               xmas_count += across;
+    if (r >= (row_begin + 3))      xmas_count += down;
+  }
+
+  return xmas_count;
+}
+
+long long crossword_count_fused(const struct crossword_search *cs, int row_begin, int row_end,
+                                struct match_sink *sink)
+{
+  if (sink == NULL) {
+    return crossword_fused_scan(cs, row_begin, row_end, NULL);
+  }
+
+  return crossword_fused_scan(cs, row_begin, row_end, sink);
+}
+
+// Set bit `i` of `out[l]` where byte `i` of `cells` is letter
+//  `l` of XMAS, for 64 bytes.
+static void bitboard_classify(const char *cells, uint64_t out[BB_LETTERS])
+{
+#ifdef HAVE_X86_KERNELS
+  const __m128i x = _mm_set1_epi8('X');
+  const __m128i m = _mm_set1_epi8('M');
+  const __m128i a = _mm_set1_epi8('A');
+  const __m128i s = _mm_set1_epi8('S');
+
+  for (int l = 0; l < BB_LETTERS; l++) {
+    out[l] = 0;
+  }
+
+  for (int i = 0; i < 64; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&cells[i]);
+
+    out[BB_X] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, x)) << i;
+    out[BB_M] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, m)) << i;
+    out[BB_A] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, a)) << i;
+    out[BB_S] |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, s)) << i;
+  }
+#else
+  for (int l = 0; l < BB_LETTERS; l++) {
+    out[l] = 0;
+  }
+
+  for (int i = 0; i < 64; i++) {
+    switch (cells[i]) {
+      case 'X': out[BB_X] |= (1ULL << i); break;
+      case 'M': out[BB_M] |= (1ULL << i); break;
+      case 'A': out[BB_A] |= (1ULL << i); break;
+      case 'S': out[BB_S] |= (1ULL << i); break;
+      default: break;
+    }
+  }
+#endif
+}
+
+int bitboard_init(struct bitboard *bb, const struct crossword_search *cs, int rows)
+{
+  size_t used = ((size_t)cs->cols + 63) / 64;
+
+  bb->rows = rows;
+  bb->cols = cs->cols;
+  bb->words = ((used + BITBOARD_LANES - 1) / BITBOARD_LANES) * BITBOARD_LANES;
+  bb->stride = bb->words + 2;
+  bb->size = BB_LETTERS * (size_t)(bb->rows + GRID_BORDER) * bb->stride * sizeof(uint64_t);
+
+  // Anonymous memory starts out zeroed, which takes care of
+  //  the padding words.
+  bb->bits = mmap(NULL, bb->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bb->bits == MAP_FAILED) {
+    bb->bits = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+void bitboard_fill(struct bitboard *bb, const struct crossword_search *cs, int row_begin, int row_end)
+{
+  size_t used = ((size_t)cs->cols + 63) / 64;
+
+  // The last word of a row may pick up bytes past the end of
+  //  the crossword, from the padding or even the next row, so
+  //  those bits are masked off.
+  uint64_t tail = ((cs->cols % 64) == 0) ? ~0ULL : ((1ULL << (cs->cols % 64)) - 1);
+  uint64_t letters[BB_LETTERS];
+
+  for (int r = row_begin; r < row_end; r++) {
+    const char *cells = &cs->crossword[crossword_index(cs, r, 0)];
+
+    for (size_t w = 0; w < used; w++) {
+      bitboard_classify(&cells[w * 64], letters);
+
+      for (int l = 0; l < BB_LETTERS; l++) {
+        bitboard_row(bb, l, r - row_begin)[w] = (w == (used - 1)) ? (letters[l] & tail) : letters[l];
+      }
+    }
+  }
+
+  // Whatever an earlier fill left below the new rows must not
+  //  match. `bitboard_row()` points past a row's leading padding
+  //  word, so the clear starts one word back to stay inside the
+  //  rows.
+  for (int l = 0; l < BB_LETTERS; l++) {
+    memset(&bitboard_row(bb, l, row_end - row_begin)[-1], 0, bb->stride * GRID_BORDER * sizeof(uint64_t));
+  }
+}
+
+void bitboard_cleanup(struct bitboard *bb)
+{
+  if (bb->bits != NULL) munmap(bb->bits, bb->size);
+
+  bb->bits = NULL;
+  bb->size = 0;
+}
+
+// Letters of a match in the order they're looked for, reading
+//  away from the cell it's counted at: XMAS, then SAMX for the
+//  reverse direction.
+static const int bitboard_order[2][4] = {
+  {BB_X, BB_M, BB_A, BB_S},
+  {BB_S, BB_A, BB_M, BB_X}
+};
+
+// Return word `w` of `row` with every bit moved from column
+//  `c + k` down to column `c`, for `k` in [1, 3].
+static inline uint64_t bitboard_right(const uint64_t *row, size_t w, int k)
+{
+  return (row[w] >> k) | (row[w + 1] << (64 - k));
+}
+
+// Same as `bitboard_right()`, but from column `c - k`
+static inline uint64_t bitboard_left(const uint64_t *row, size_t w, int k)
+{
+  return (row[w] << k) | (row[w - 1] >> (64 - k));
+}
+
+// Set `hits` to the matches starting in word `w` across, down
+//  and along both diagonals, given the rows each letter of the
+//  word is taken from
+static inline void bitboard_matches(const uint64_t *const across[4], const uint64_t *const down[4],
+                                    size_t w, uint64_t hits[4])
+{
+  hits[0] = across[0][w] & bitboard_right(across[1], w, 1) &
+            bitboard_right(across[2], w, 2) & bitboard_right(across[3], w, 3);
+  hits[1] = down[0][w] & down[1][w] & down[2][w] & down[3][w];
+  hits[2] = down[0][w] & bitboard_right(down[1], w, 1) &
+            bitboard_right(down[2], w, 2) & bitboard_right(down[3], w, 3);
+  hits[3] = down[0][w] & bitboard_left(down[1], w, 1) &
+            bitboard_left(down[2], w, 2) & bitboard_left(down[3], w, 3);
+}
+
+long long bitboard_count_scalar(const struct bitboard *bb, int row_begin, int row_end)
+{
+  const uint64_t *across[4];
+  const uint64_t *down[4];
+  uint64_t hits[4];
+  long long xmas_count = 0;
+
+  for (int r = row_begin; r < row_end; r++) {
+    for (int o = 0; o < 2; o++) {
+      // Letter `i` of the word is on row `r` when reading
+      //  across, and on row `r + i` in every other direction.
+      for (int i = 0; i < 4; i++) {
+        across[i] = bitboard_row(bb, bitboard_order[o][i], r);
+        down[i] = bitboard_row(bb, bitboard_order[o][i], r + i);
+      }
+
+      for (size_t w = 0; w < bb->words; w++) {
+        bitboard_matches(across, down, w, hits);
+
+        xmas_count += __builtin_popcountll(hits[0]) + __builtin_popcountll(hits[1]) +
+                      __builtin_popcountll(hits[2]) + __builtin_popcountll(hits[3]);
+      }
+    }
+  }
+
+  return xmas_count;
+}
+
+long long bitboard_record(const struct bitboard *bb, int row_begin, int row_end, int row_offset,
+                          struct match_sink *sink)
+{
+  // For each of the matches `bitboard_matches()` finds, reading
+  //  XMAS and then SAMX, the way it reads and where its X is
+  //  from the cell it was found at
+  static const struct {
+    enum direction direction;
+    int row;
+    int col;
+  } found[2][4] = {
+    {{DIR_E, 0, 0}, {DIR_S, 0, 0}, {DIR_SE, 0, 0}, {DIR_SW, 0,  0}},
+    {{DIR_W, 0, 3}, {DIR_N, 3, 0}, {DIR_NW, 3, 3}, {DIR_NE, 3, -3}}
+  };
+
+  const uint64_t *across[4];
+  const uint64_t *down[4];
+  uint64_t hits[4];
+  uint64_t bits;
+  int col;
+  long long xmas_count = 0;
+
+  for (int r = row_begin; r < row_end; r++) {
+    for (int o = 0; o < 2; o++) {
+      for (int i = 0; i < 4; i++) {
+        across[i] = bitboard_row(bb, bitboard_order[o][i], r);
+        down[i] = bitboard_row(bb, bitboard_order[o][i], r + i);
+      }
+
+      for (size_t w = 0; w < bb->words; w++) {
+        bitboard_matches(across, down, w, hits);
+
+        for (int d = 0; d < 4; d++) {
+          xmas_count += __builtin_popcountll(hits[d]);
+
+          if (sink->mode == RECORD_COUNT) {
+            sink->direction_count[found[o][d].direction] += __builtin_popcountll(hits[d]);
+            continue;
+          }
+
+          for (bits = hits[d]; bits != 0; bits &= bits - 1) {
+            col = (int)(w * 64) + __builtin_ctzll(bits);
+            match_sink_record(sink, r + row_offset + found[o][d].row, col + found[o][d].col,
+                              found[o][d].direction);
+          }
+        }
+      }
+    }
+  }
+
+  return xmas_count;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+static inline __m256i bitboard_right_avx2(const uint64_t *row, size_t w, int k)
+{
+  return _mm256_or_si256(_mm256_srli_epi64(_mm256_loadu_si256((const __m256i *)&row[w]), k),
+                         _mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)&row[w + 1]), 64 - k));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i bitboard_left_avx2(const uint64_t *row, size_t w, int k)
+{
+  return _mm256_or_si256(_mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)&row[w]), k),
+                         _mm256_srli_epi64(_mm256_loadu_si256((const __m256i *)&row[w - 1]), 64 - k));
+}
+
+// AVX2 has no popcount instruction, so look up the bits set in
+//  each nibble and sum the bytes of each 64-bit lane.
+__attribute__((target("avx2")))
+static inline __m256i bitboard_popcount_avx2(__m256i v)
+{
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+  __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+  __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+long long bitboard_count_avx2(const struct bitboard *bb, int row_begin, int row_end)
+{
+  const uint64_t *across[4];
+  const uint64_t *down[4];
+  __m256i horizontal;
+  __m256i vertical;
+  __m256i diagonal;
+  __m256i off_diagonal;
+  __m256i total = _mm256_setzero_si256();
+
+  for (int r = row_begin; r < row_end; r++) {
+    for (int o = 0; o < 2; o++) {
+      for (int i = 0; i < 4; i++) {
+        across[i] = bitboard_row(bb, bitboard_order[o][i], r);
+        down[i] = bitboard_row(bb, bitboard_order[o][i], r + i);
+      }
+
+      for (size_t w = 0; w < bb->words; w += 4) {
+        __m256i first = _mm256_loadu_si256((const __m256i *)&down[0][w]);
+
+        horizontal = _mm256_and_si256(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)&across[0][w]),
+                                                       bitboard_right_avx2(across[1], w, 1)),
+                                      _mm256_and_si256(bitboard_right_avx2(across[2], w, 2),
+                                                       bitboard_right_avx2(across[3], w, 3)));
+        vertical = _mm256_and_si256(_mm256_and_si256(first, _mm256_loadu_si256((const __m256i *)&down[1][w])),
+                                    _mm256_and_si256(_mm256_loadu_si256((const __m256i *)&down[2][w]),
+                                                     _mm256_loadu_si256((const __m256i *)&down[3][w])));
+        diagonal = _mm256_and_si256(_mm256_and_si256(first, bitboard_right_avx2(down[1], w, 1)),
+                                    _mm256_and_si256(bitboard_right_avx2(down[2], w, 2),
+                                                     bitboard_right_avx2(down[3], w, 3)));
+        off_diagonal = _mm256_and_si256(_mm256_and_si256(first, bitboard_left_avx2(down[1], w, 1)),
+                                        _mm256_and_si256(bitboard_left_avx2(down[2], w, 2),
+                                                         bitboard_left_avx2(down[3], w, 3)));
+
+        total = _mm256_add_epi64(total, _mm256_add_epi64(_mm256_add_epi64(bitboard_popcount_avx2(horizontal),
+                                                                          bitboard_popcount_avx2(vertical)),
+                                                         _mm256_add_epi64(bitboard_popcount_avx2(diagonal),
+                                                                          bitboard_popcount_avx2(off_diagonal))));
+      }
+    }
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, total);
+
+  return (long long)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i bitboard_right_avx512(const uint64_t *row, size_t w, int k)
+{
+  return _mm512_or_si512(_mm512_srli_epi64(_mm512_loadu_si512((const void *)&row[w]), k),
+                         _mm512_slli_epi64(_mm512_loadu_si512((const void *)&row[w + 1]), 64 - k));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i bitboard_left_avx512(const uint64_t *row, size_t w, int k)
+{
+  return _mm512_or_si512(_mm512_slli_epi64(_mm512_loadu_si512((const void *)&row[w]), k),
+                         _mm512_srli_epi64(_mm512_loadu_si512((const void *)&row[w - 1]), 64 - k));
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+long long bitboard_count_avx512(const struct bitboard *bb, int row_begin, int row_end)
+{
+  const uint64_t *across[4];
+  const uint64_t *down[4];
+  __m512i horizontal;
+  __m512i vertical;
+  __m512i diagonal;
+  __m512i off_diagonal;
+  __m512i total = _mm512_setzero_si512();
+
+  for (int r = row_begin; r < row_end; r++) {
+    for (int o = 0; o < 2; o++) {
+      for (int i = 0; i < 4; i++) {
+        across[i] = bitboard_row(bb, bitboard_order[o][i], r);
+        down[i] = bitboard_row(bb, bitboard_order[o][i], r + i);
+      }
+
+      for (size_t w = 0; w < bb->words; w += 8) {
+        __m512i first = _mm512_loadu_si512((const void *)&down[0][w]);
+
+        horizontal = _mm512_and_si512(_mm512_and_si512(_mm512_loadu_si512((const void *)&across[0][w]),
+                                                       bitboard_right_avx512(across[1], w, 1)),
+                                      _mm512_and_si512(bitboard_right_avx512(across[2], w, 2),
+                                                       bitboard_right_avx512(across[3], w, 3)));
+        vertical = _mm512_and_si512(_mm512_and_si512(first, _mm512_loadu_si512((const void *)&down[1][w])),
+                                    _mm512_and_si512(_mm512_loadu_si512((const void *)&down[2][w]),
+                                                     _mm512_loadu_si512((const void *)&down[3][w])));
+        diagonal = _mm512_and_si512(_mm512_and_si512(first, bitboard_right_avx512(down[1], w, 1)),
+                                    _mm512_and_si512(bitboard_right_avx512(down[2], w, 2),
+                                                     bitboard_right_avx512(down[3], w, 3)));
+        off_diagonal = _mm512_and_si512(_mm512_and_si512(first, bitboard_left_avx512(down[1], w, 1)),
+                                        _mm512_and_si512(bitboard_left_avx512(down[2], w, 2),
+                                                         bitboard_left_avx512(down[3], w, 3)));
+
+        total = _mm512_add_epi64(total, _mm512_add_epi64(_mm512_add_epi64(_mm512_popcnt_epi64(horizontal),
+                                                                          _mm512_popcnt_epi64(vertical)),
+                                                         _mm512_add_epi64(_mm512_popcnt_epi64(diagonal),
+                                                                          _mm512_popcnt_epi64(off_diagonal))));
+      }
+    }
+  }
+
+  return (long long)_mm512_reduce_add_epi64(total);
+}
+#endif
+
+bitboard_kernel bitboard_select_kernel(void)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) {
+    return bitboard_count_avx512;
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    return bitboard_count_avx2;
+  }
+#endif
+
+  return bitboard_count_scalar;
+}
+
+long long crossword_count_bitboard(const struct crossword_search *cs, struct search_context *ctx,
+                                   int row_begin, int row_end)
+{
+  bitboard_fill(&ctx->bb, cs, row_begin, crossword_search_stop_row(cs, row_end));
+
+  if (ctx->sink != NULL) {
+    return bitboard_record(&ctx->bb, 0, row_end - row_begin, row_begin, ctx->sink);
+  }
+
+  return ctx->kernel(&ctx->bb, 0, row_end - row_begin);
+}
+
+int search_context_init(struct search_context *ctx, const struct crossword_search *cs,
+                        enum search_engine engine, int rows, struct match_sink *sink)
+{
+  ctx->engine = engine;
+  ctx->state = 0b0000;
+  memset(ctx->idx, 0, sizeof(ctx->idx));
+  ctx->sink = ((sink != NULL) && (sink->mode != RECORD_NONE)) ? sink : NULL;
+  ctx->bb.bits = NULL;
+  ctx->kernel = NULL;
+
+  // Room for the rows being searched and the ones below them
+  //  that their matches can reach into
+  if (engine == ENGINE_BITBOARD) {
+    ctx->kernel = bitboard_select_kernel();
+    return bitboard_init(&ctx->bb, cs, rows + GRID_BORDER);
+  }
+
+  return 0;
+}
+
+void search_context_cleanup(struct search_context *ctx)
+{
+  bitboard_cleanup(&ctx->bb);
+}
+
+long long crossword_count_rows(const struct crossword_search *cs, struct search_context *ctx,
+                               int row_begin, int row_end)
+{
+  switch (ctx->engine) {
+    case ENGINE_TRAVERSAL:
+      return crossword_count_traversal(cs, ctx, row_begin, row_end);
+
+    case ENGINE_FUSED:
+      return crossword_count_fused(cs, row_begin, row_end, ctx->sink);
+
+    case ENGINE_BITBOARD:
+      return crossword_count_bitboard(cs, ctx, row_begin, row_end);
+
+    default:
+      return -1;
+  }
+}
+
+long long crossword_count(struct crossword_search *cs, enum search_engine engine,
+                          struct match_sink *sink)
+{
+  struct search_context ctx;
+
+  if (search_context_init(&ctx, cs, engine, cs->rows, sink)) {
+    search_context_cleanup(&ctx);
+    return -1;
+  }
+
+  long long xmas_count = crossword_count_rows(cs, &ctx, 0, cs->rows);
+
+  search_context_cleanup(&ctx);
+
+  return xmas_count;
+}
+
+void *tile_worker(void *arg)
+{
+  struct tile_job *job = (struct tile_job *)arg;
+  const struct crossword_search *cs = job->cs;
+  struct search_context ctx;
+  int row_begin;
+  int row_end;
+
+  job->xmas_count = 0;
+  job->ret = search_context_init(&ctx, cs, job->engine, job->tile_rows, &job->sink);
+
+  // A tile reads the GRID_BORDER rows below it as well, but
+  //  only counts the matches that start inside it, so a match
+  //  reaching across two tiles is counted once.
+  for (int t = job->first; (job->ret == 0) && (((long long)t * job->tile_rows) < cs->rows); t += job->step) {
+    row_begin = t * job->tile_rows;
+    row_end = ((cs->rows - row_begin) < job->tile_rows) ? cs->rows : (row_begin + job->tile_rows);
+
+    job->xmas_count += crossword_count_rows(cs, &ctx, row_begin, row_end);
+  }
+
+  search_context_cleanup(&ctx);
+
+  return NULL;
+}
+
+long long parallel_count(const struct crossword_search *cs, enum search_engine engine, int threads,
+                         struct match_sink *sink)
+{
+  pthread_t tid[MAX_THREADS];
+  struct tile_job jobs[MAX_THREADS];
+  int started = 0;
+  int ret = 0;
+
+  // Small grids get shorter tiles so every thread has some
+  int tile_rows = (cs->rows + threads - 1) / threads;
+  if (tile_rows > TILE_ROWS) {
+    tile_rows = TILE_ROWS;
+  }
+
+  // Threads keep a list rather than each painting a whole map
+  //  of their own; the lists are painted onto `sink` after.
+  enum record_mode mode = (sink == NULL) ? RECORD_NONE : sink->mode;
+  if (mode == RECORD_MAP) {
+    mode = RECORD_LIST;
+  }
+
+  for (int t = 0; t < threads; t++) {
+    jobs[t].cs = cs;
+    jobs[t].engine = engine;
+    jobs[t].tile_rows = tile_rows;
+    jobs[t].first = t;
+    jobs[t].step = threads;
+    jobs[t].xmas_count = 0;
+    jobs[t].ret = 0;
+
+    if (match_sink_init(&jobs[t].sink, mode, cs->rows, cs->cols)) {
+      ret = 1;
+      break;
+    }
+
+    if (pthread_create(&tid[t], NULL, tile_worker, &jobs[t])) {
+      match_sink_cleanup(&jobs[t].sink);
+      ret = 1;
+      break;
+    }
+
+    started++;
+  }
+
+  long long xmas_count = 0;
+
+  for (int t = 0; t < started; t++) {
+    pthread_join(tid[t], NULL);
+
+    ret = ret || jobs[t].ret;
+    xmas_count += jobs[t].xmas_count;
+
+    if (sink != NULL) {
+      match_sink_merge(sink, &jobs[t].sink);
+    }
+    match_sink_cleanup(&jobs[t].sink);
+  }
+
+  return ret ? -1 : xmas_count;
+}
+
+void word_search_init(struct word_search *ws)
+{
+  memset(ws, 0, sizeof(*ws));
+}
+
+void word_search_cleanup(struct word_search *ws)
+{
+  for (int i = 0; i < ws->words; i++) {
+    free(ws->word[i]);
+  }
+
+  free(ws->word);
+  free(ws->next);
+  free(ws->match);
+  free(ws->report);
+  free(ws->ends);
+  free(ws->end_word);
+  free(ws->end_next);
+
+  memset(ws, 0, sizeof(*ws));
+}
+
+int word_search_add(struct word_search *ws, const char *word)
+{
+  size_t len = strlen(word);
+
+  // A single letter would be found once along every line
+  //  through it, so it isn't a word here.
+  if ((len < 2) || (len > WORD_MAX_LEN)) {
+    return 1;
+  }
+
+  if (ws->words == ws->capacity) {
+    int capacity = (ws->capacity == 0) ? 16 : (ws->capacity * 2);
+    char **grown = realloc(ws->word, (size_t)capacity * sizeof(char *));
+
+    if (grown == NULL) {
+      return 1;
+    }
+
+    ws->word = grown;
+    ws->capacity = capacity;
+  }
+
+  ws->word[ws->words] = malloc(len + 1);
+  if (ws->word[ws->words] == NULL) {
+    return 1;
+  }
+
+  memcpy(ws->word[ws->words], word, len + 1);
+  ws->words++;
+
+  return 0;
+}
+
+int word_search_load(struct word_search *ws, const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return 1;
+  }
+
+  char line[WORD_MAX_LEN + 3];
+  size_t len;
+  int ret = 0;
+
+  while ((ret == 0) && fgets(line, sizeof(line), f)) {
+    len = strcspn(line, "\r\n");
+
+    // No line ending means the line didn't fit
+    if ((line[len] == '\0') && !feof(f)) {
+      ret = 1;
+      break;
+    }
+
+    line[len] = '\0';
+
+    if (len > 0) {
+      ret = word_search_add(ws, line);
+    }
+  }
+
+  fclose(f);
+
+  return ret;
+}
+
+// Follow `word` (read backwards if `reverse`) from the start
+//  state, adding states as needed, and record word `w` as
+//  ending where it leads.
+static void word_search_insert(struct word_search *ws, const char *word, bool reverse, int w)
+{
+  int len = (int)strlen(word);
+  int state = 0;
+  int *next;
+
+  for (int i = 0; i < len; i++) {
+    next = &ws->next[(state * ws->classes) + ws->letter_class[(uint8_t)word[reverse ? (len - 1 - i) : i]]];
+
+    if (*next == 0) {
+      *next = ws->states++;
+    }
+
+    state = *next;
+  }
+
+  ws->end_word[ws->end_count] = w;
+  ws->end_next[ws->end_count] = ws->ends[state];
+  ws->ends[state] = ws->end_count++;
+}
+
+// Return whether `word` reads the same backwards
+static bool word_is_palindrome(const char *word)
+{
+  size_t len = strlen(word);
+
+  for (size_t i = 0; i < (len / 2); i++) {
+    if (word[i] != word[len - 1 - i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int word_search_build(struct word_search *ws)
+{
+  size_t letters = 0;
+
+  // Give every letter used by some word its own class
+  memset(ws->letter_class, 0, sizeof(ws->letter_class));
+  ws->classes = 1;
+
+  for (int i = 0; i < ws->words; i++) {
+    for (const char *p = ws->word[i]; *p != '\0'; p++) {
+      if (ws->letter_class[(uint8_t)*p] == 0) {
+        ws->letter_class[(uint8_t)*p] = (uint8_t)ws->classes++;
+      }
+
+      letters++;
+    }
+  }
+
+  // At most one new state per letter, for each word and its
+  //  reverse, plus the start state
+  size_t max_states = 1 + (2 * letters);
+
+  ws->next = calloc(max_states * (size_t)ws->classes, sizeof(int));
+  ws->match = calloc(max_states, sizeof(int));
+  ws->report = calloc(max_states, sizeof(int));
+  ws->ends = malloc(max_states * sizeof(int));
+  ws->end_word = malloc(2 * (size_t)(ws->words + 1) * sizeof(int));
+  ws->end_next = malloc(2 * (size_t)(ws->words + 1) * sizeof(int));
+
+  int *queue = malloc(max_states * sizeof(int));
+  int *fail = calloc(max_states, sizeof(int));
+
+  if ((ws->next == NULL) || (ws->match == NULL) || (ws->report == NULL) || (ws->ends == NULL) ||
+      (ws->end_word == NULL) || (ws->end_next == NULL) || (queue == NULL) || (fail == NULL)) {
+    free(queue);
+    free(fail);
+    return 1;
+  }
+
+  for (size_t s = 0; s < max_states; s++) {
+    ws->ends[s] = -1;
+  }
+
+  ws->states = 1;
+  ws->end_count = 0;
+
+  // A palindrome read backwards is the same cells read the
+  //  other way, so it's only looked for once.
+  for (int i = 0; i < ws->words; i++) {
+    word_search_insert(ws, ws->word[i], false, i);
+
+    if (!word_is_palindrome(ws->word[i])) {
+      word_search_insert(ws, ws->word[i], true, i);
+    }
+  }
+
+  // Breadth-first, point every missing transition to where
+  //  the longest suffix that is still a prefix of some word
+  //  would go, turning the trie into a DFA. A state that is
+  //  0 in `next` at this point is missing, since the start
+  //  state is nobody's child.
+  int head = 0;
+  int tail = 0;
+  int state;
+  int child;
+
+  for (int c = 0; c < ws->classes; c++) {
+    child = ws->next[c];
+
+    if (child != 0) {
+      queue[tail++] = child;
+    }
+  }
+
+  while (head < tail) {
+    state = queue[head++];
+
+    ws->match[state] = (ws->ends[state] >= 0) ? state : ws->match[fail[state]];
+    ws->report[state] = ws->match[fail[state]];
+
+    for (int c = 0; c < ws->classes; c++) {
+      child = ws->next[(state * ws->classes) + c];
+
+      if (child != 0) {
+        fail[child] = ws->next[(fail[state] * ws->classes) + c];
+        queue[tail++] = child;
+      }
+      else {
+        ws->next[(state * ws->classes) + c] = ws->next[(fail[state] * ws->classes) + c];
+      }
+    }
+  }
+
+  free(queue);
+  free(fail);
+
+  return 0;
+}
+
+// Add one to the count of every word that ends at `state`
+static inline void word_search_emit(const struct word_search *ws, int state, long long *counts)
+{
+  for (int s = ws->match[state]; s != 0; s = ws->report[s]) {
+    for (int e = ws->ends[s]; e >= 0; e = ws->end_next[e]) {
+      counts[ws->end_word[e]]++;
+    }
+  }
+}
+
+int word_search_count(const struct word_search *ws, const struct crossword_search *cs,
+                      long long *counts)
+{
+  // Every line in every orientation runs its own copy of the
+  //  automaton, but they all advance together in one row-major
+  //  pass: one state for the current row, one per column, and
+  //  one per diagonal each way. The lines going down all start
+  //  in the start state at their top end.
+  int lines = cs->rows + cs->cols - 1;
+  int *column = calloc((size_t)cs->cols, sizeof(int));
+  int *diagonal = calloc((size_t)lines, sizeof(int));
+  int *off_diagonal = calloc((size_t)lines, sizeof(int));
+
+  if ((column == NULL) || (diagonal == NULL) || (off_diagonal == NULL)) {
+    free(column);
+    free(diagonal);
+    free(off_diagonal);
+    return 1;
+  }
+
+  for (int i = 0; i < ws->words; i++) {
+    counts[i] = 0;
+  }
+
+  const int *next = ws->next;
+  int classes = ws->classes;
+  int across;
+  int k;
+  int *d;
+  int *o;
+
+  for (int r = 0; r < cs->rows; r++) {
+    const char *cells = &cs->crossword[crossword_index(cs, r, 0)];
+    across = 0;
+
+    for (int c = 0; c < cs->cols; c++) {
+      k = ws->letter_class[(uint8_t)cells[c]];
+
+      // `diagonal` runs like /, so row + col is the same along
+      //  it; `off_diagonal` runs like \, so col - row is.
+      d = &diagonal[r + c];
+      o = &off_diagonal[c - r + (cs->rows - 1)];
+
+      across = next[(across * classes) + k];
+      column[c] = next[(column[c] * classes) + k];
+      *d = next[(*d * classes) + k];
+      *o = next[(*o * classes) + k];
+
+      word_search_emit(ws, across, counts);
+      word_search_emit(ws, column[c], counts);
+      word_search_emit(ws, *d, counts);
+      word_search_emit(ws, *o, counts);
+    }
+  }
+
+  free(column);
+  free(diagonal);
+  free(off_diagonal);
+
+  return 0;
+}
+
+int run_word_search(const struct crossword_search *cs, const char *filename)
+{
+  struct word_search ws;
+  long long *counts = NULL;
+  int ret;
+
+  word_search_init(&ws);
+
+  ret = word_search_load(&ws, filename) || (ws.words == 0) || word_search_build(&ws);
+
+  if (ret == 0) {
+    counts = malloc((size_t)ws.words * sizeof(long long));
+    ret = (counts == NULL) || word_search_count(&ws, cs, counts);
+  }
+
+  if (ret == 0) {
+    for (int i = 0; i < ws.words; i++) {
+      printf("%s: %lld\n", ws.word[i], counts[i]);
+    }
+  }
+
+  free(counts);
+  word_search_cleanup(&ws);
+
+  return ret;
+}
+
+// Small xorshift generator so the benchmark grid is the same
+//  on every run and platform.
+static uint32_t bench_rand(uint32_t *seed)
+{
+  uint32_t x = *seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return *seed = x;
+}
+
+// Return the time in seconds from a monotonic clock
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+}
+
+int run_benchmark(int size, int threads)
+{
+  static const char *engine_names[ENGINES] = {"traversal", "fused", "bitboard"};
+
+  struct crossword_search cs;
+
+  if (crossword_alloc(&cs, (size_t)size, (size_t)size)) {
+    return 1;
+  }
+
+  uint32_t seed = 0x2024u;
+
+  for (int r = 0; r < cs.rows; r++) {
+    for (int c = 0; c < cs.cols; c++) {
+      cs.crossword[crossword_index(&cs, r, c)] = "XMAS"[bench_rand(&seed) % 4];
+    }
+  }
+
+  double cells = (double)cs.rows * (double)cs.cols;
+  double baseline = 0.0;
+  double best;
+  double start;
+  double elapsed;
+  double rate;
+  long long xmas_count = 0;
+
+  printf("%-12s %12s %10s %16s\n", "engine", "Mcells/s", "speedup", "count");
+
+  // Speedups are relative to the original traversal
+  for (int e = 0; e < ENGINES; e++) {
+    // Keep the fastest of a few runs to cut down on noise
+    best = 0.0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+      start = bench_now();
+      xmas_count = (threads > 1) ?
+                   parallel_count(&cs, (enum search_engine)e, threads, NULL) :
+                   crossword_count(&cs, (enum search_engine)e, NULL);
+      elapsed = bench_now() - start;
+
+      if (xmas_count < 0) {
+        crossword_cleanup(&cs);
+        return 1;
+      }
+
+      if ((r == 0) || (elapsed < best)) {
+        best = elapsed;
+      }
+    }
+
+    rate = cells / 1e6 / ((best > 0.0) ? best : 1e-9);
+    if (e == 0) {
+      baseline = rate;
+    }
+
+    printf("%-12s %12.1f %9.2fx %16lld\n", engine_names[e], rate,
+           rate / baseline, xmas_count);
+  }
+
+  crossword_cleanup(&cs);
+
+  return 0;
+}